@@ -0,0 +1,74 @@
+#include "NeuralNet.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+template <class T>
+nn::Adam<T>::Adam (double beta_1, double beta_2, double epsilon, double weight_decay) {
+    this->beta_1 = beta_1;
+    this->beta_2 = beta_2;
+    this->epsilon = epsilon;
+    this->weight_decay = weight_decay;
+}
+
+template <class T>
+void nn::Adam<T>::step (Parameter<T> &param, T learning_rate) {
+    using C = typename Matrix::compute_type;
+    if (this->momentum.shape() != param.value.shape()) {
+        this->momentum = Matrix(param.value.shape());
+        this->velocity = Matrix(param.value.shape());
+        this->t = 0;
+    }
+    this->t++;
+
+    // Bias corrections folded into the step size and the epsilon:
+    // lr * m / (1 - b1^t) / (sqrt(v / (1 - b2^t)) + eps)
+    //   = step * m / (sqrt(v) + eps * sqrt(1 - b2^t))
+    double correction_1 = 1.0 - std::pow(this->beta_1, (double)this->t);
+    double correction_2 = std::sqrt(1.0 - std::pow(this->beta_2, (double)this->t));
+    C step_size = C((double)learning_rate * correction_2 / correction_1);
+    C eps = C(this->epsilon * correction_2);
+    C decay = C(1.0 - (double)learning_rate * this->weight_decay);
+    C b1 = C(this->beta_1), b2 = C(this->beta_2);
+
+    T *w = param.value.data();
+    const T *g = param.grad.data();
+    T *m = this->momentum.data();
+    T *v = this->velocity.data();
+    long size = (long)std::get<0>(param.value.shape()) * std::get<1>(param.value.shape());
+    auto update = [&](long begin, long end, C decay) {
+        #pragma omp simd
+        for (long i = begin; i < end; i++) {
+            C grad = C(g[i]);
+            C m_i = b1 * C(m[i]) + (C(1) - b1) * grad;
+            C v_i = b2 * C(v[i]) + (C(1) - b2) * grad * grad;
+            m[i] = T(m_i);
+            v[i] = T(v_i);
+            w[i] = T(C(w[i]) * decay - step_size * m_i / (std::sqrt(v_i) + eps));
+        }
+    };
+    vector<std::pair<long, long>> decayed = this->decayed;
+    if (decayed.empty())
+        decayed.push_back({ 0, size });
+    exec::parallel_for(size, exec::ELEMENTWISE, [&](long begin, long end) {
+        // The chunk is split at the edges of the decay ranges, the rest keeps its scale
+        long i = begin;
+        for (auto &range : decayed) {
+            long first = std::max(range.first, i), last = std::min(range.second, end);
+            if (first >= last)
+                continue;
+            update(i, first, C(1));
+            update(first, last, decay);
+            i = last;
+        }
+        update(i, end, C(1));
+    }, 4);
+}
+
+template <class T>
+std::shared_ptr<nn::Optim<T>> nn::Adam<T>::copy () {
+    return std::shared_ptr<nn::Optim<T>>( new Adam(*this) );
+}
+
+template class nn::Adam<double>;
+template class nn::Adam<float>;
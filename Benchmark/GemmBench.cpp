@@ -0,0 +1,102 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <omp.h>
+#include "../MatrixLib/Matrix.hpp"
+
+/***********************************************************
+ * GemmBench compares Matrix::dot against the reference
+ * triple loop it replaced (transpose the right operand,
+ * accumulate straight into the output) on the shapes that
+ * nn::Model multiplies during a training step with batch 400
+ * and 3072 -> 512 -> 10 layers. Transposed operands are
+ * materialized with T() for the reference, as FCLayer used
+ * to do, and passed as flags to Matrix::dot otherwise. The
+ * same products are also timed on MatrixF (float32) and
+ * MatrixBF16 (bfloat16 storage, float accumulation).
+ * Usage: ./gemm_bench.x86_64 [repeats]
+ **********************************************************/
+
+// The former Matrix::dot kernel, kept here as a baseline
+static Matrix reference_dot (Matrix &a, Matrix &b) {
+    int m = std::get<0>(a.shape()), k = std::get<1>(a.shape()), n = std::get<1>(b.shape());
+    Matrix b_t = b.T();
+    Matrix c(m, n);
+    const double *pa = a.data(), *pb = b_t.data();
+    double *pc = c.data();
+
+    #pragma omp parallel for
+    for (int i = 0; i < m; i++) {
+        int i_offset = i * k;
+        for (int j = 0; j < n; j++) {
+            int j_offset = j * k;
+            for (int p = 0; p < k; p++)
+                pc[i * n + j] += pa[i_offset + p] * pb[j_offset + p];
+        }
+    }
+    return c;
+}
+
+template <class F>
+static double time_ms (F f, int repeats) {
+    f();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repeats; r++)
+        f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0 / repeats;
+}
+
+int main (int argc, char * argv[]) {
+    int repeats = (argc > 1) ? std::stoi(argv[1]) : 3;
+    // m, k, n of op(A) x op(B), transpose flags and where the product comes from
+    struct Shape { int m, k, n; bool trans_a, trans_b; const char *name; };
+    vector<Shape> shapes {
+        { 400, 3072, 512, false, false, "fc1 forward   X.dot(W1)" },
+        { 400, 512, 10, false, false, "fc2 forward   X.dot(W2)" },
+        { 3072, 400, 512, true, false, "fc1 backward  X^T x d_out" },
+        { 400, 512, 3072, false, true, "fc1 backward  d_out x W1^T" },
+        { 512, 400, 10, true, false, "fc2 backward  X^T x d_out" },
+        { 400, 10, 512, false, true, "fc2 backward  d_out x W2^T" },
+    };
+
+    std::cout << "threads: " << omp_get_max_threads() << ", repeats: " << repeats << "\n";
+    std::cout << std::left << std::setw(34) << "shape (m x k x n)" << std::setw(34) << "call site"
+              << std::right << std::setw(12) << "ref GFLOPS" << std::setw(12) << "dot GFLOPS"
+              << std::setw(10) << "speedup" << std::setw(12) << "max |diff|"
+              << std::setw(12) << "f32 GFLOPS" << std::setw(12) << "bf16 GFLOPS" << "\n";
+
+    for (auto s : shapes) {
+        Matrix a = s.trans_a ? Matrix(s.k, s.m).fill_rand() : Matrix(s.m, s.k).fill_rand();
+        Matrix b = s.trans_b ? Matrix(s.n, s.k).fill_rand() : Matrix(s.k, s.n).fill_rand();
+        Matrix c_ref, c_new;
+
+        double ref_ms = time_ms([&]() {
+            Matrix op_a = s.trans_a ? a.T() : a;
+            Matrix op_b = s.trans_b ? b.T() : b;
+            c_ref = reference_dot(op_a, op_b);
+        }, repeats);
+        double new_ms = time_ms([&]() { c_new = a.dot(b, s.trans_a, s.trans_b); }, repeats);
+
+        MatrixF a_f = a.cast<float>(), b_f = b.cast<float>(), c_f;
+        double f32_ms = time_ms([&]() { c_f = a_f.dot(b_f, s.trans_a, s.trans_b); }, repeats);
+        MatrixBF16 a_bf = a.cast<bfloat16>(), b_bf = b.cast<bfloat16>(), c_bf;
+        double bf16_ms = time_ms([&]() { c_bf = a_bf.dot(b_bf, s.trans_a, s.trans_b); }, repeats);
+
+        double max_diff = 0.0;
+        for (int i = 0; i < s.m * s.n; i++)
+            max_diff = std::max(max_diff, std::abs(c_ref.data()[i] - c_new.data()[i]));
+
+        double flops = 2.0 * s.m * s.k * s.n;
+        std::string dims = std::to_string(s.m) + " x " + std::to_string(s.k) + " x " + std::to_string(s.n);
+        std::cout << std::left << std::setw(34) << dims << std::setw(34) << s.name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(12) << flops / ref_ms / 1e6
+                  << std::setw(12) << flops / new_ms / 1e6 << std::setw(9) << ref_ms / new_ms << "x"
+                  << std::scientific << std::setprecision(1) << std::setw(12) << max_diff
+                  << std::fixed << std::setprecision(2) << std::setw(12) << flops / f32_ms / 1e6
+                  << std::setw(12) << flops / bf16_ms / 1e6 << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,289 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <sched.h>
+#include <unistd.h>
+#include <omp.h>
+#include "../MatrixLib/Matrix.hpp"
+#include "../MatrixLib/Parallel.hpp"
+
+/***********************************************************
+ * KernelBench times every Matrix operation the nn code uses
+ * (dot, T, broadcast arithmetic, reductions, exp/log,
+ * fill_rand) on the shapes of a 3072 -> 512 -> 10 model with
+ * batch 400, plus a sweep of square shapes, for double and
+ * float.
+ * --------------------------------------------------------
+ * The machine peaks are measured first: FMA throughput per
+ * element type and triad (a = b + s * c) bandwidth with
+ * working sets of half the L2, half the L3 and four times the
+ * L3. Every kernel is reported in GFLOPS and GB/s from its
+ * minimal flop and byte counts, with the share of its
+ * roofline bound
+ *      min(peak GFLOPS, flops / bytes * peak GB/s)
+ * that it reaches, the bandwidth being the one of the smallest
+ * level its bytes fit in. Kernels without a meaningful flop
+ * count (transposes, transcendental functions, random numbers)
+ * are measured against the bandwidth alone.
+ * --------------------------------------------------------
+ * Every OpenMP thread is pinned to one CPU of the process
+ * affinity mask, the time of a kernel is the median of the
+ * repeats after one warm-up call.
+ * Usage: ./kernel_bench.x86_64 [repeats] [--json file]
+ *                              [--threads n] [--filter op]
+ * The JSON keeps one result per (op, type, shape) key, to be
+ * compared between two builds.
+ **********************************************************/
+
+struct Result {
+    std::string op, type, shape;
+    double ms, flops, bytes;
+};
+
+struct Level {
+    std::string name;
+    double bytes, gbs; //working set of the triad, its bandwidth
+};
+
+struct Peaks {
+    double gflops_double, gflops_float;
+    vector<Level> levels; //L2, L3, memory
+
+    // Bandwidth of the smallest level holding the given bytes
+    double gbs (double bytes) const {
+        for (auto &level : this->levels)
+            if (bytes <= level.bytes)
+                return level.gbs;
+        return this->levels.back().gbs;
+    }
+};
+
+template <class F>
+static double median_ms (F f, int repeats) {
+    f();
+    vector<double> times;
+    for (int r = 0; r < repeats; r++) {
+        auto t1 = std::chrono::steady_clock::now();
+        f();
+        auto t2 = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// Pins OpenMP thread i to the i-th CPU of the affinity mask
+static void pin_threads () {
+    cpu_set_t mask;
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+        return;
+    vector<int> cpus;
+    for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &mask))
+            cpus.push_back(c);
+    #pragma omp parallel
+    {
+        cpu_set_t own;
+        CPU_ZERO(&own);
+        CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &own);
+        sched_setaffinity(0, sizeof(own), &own);
+    }
+}
+
+// Results of the peak loops end up here, so that they can't be optimized out
+static volatile double sink;
+
+// Independent FMA chains, enough of them to cover the FMA latency
+template <class T>
+static double peak_gflops (int threads) {
+    const int CHAINS = 128 / sizeof(T) * 4;
+    const long ITERATIONS = 2000000;
+    double ms = median_ms([&]() {
+        #pragma omp parallel num_threads(threads)
+        {
+            T acc[CHAINS];
+            for (int j = 0; j < CHAINS; j++)
+                acc[j] = T(j);
+            T a = T(0.999999 + sink), b = T(1e-7 + sink);
+            for (long i = 0; i < ITERATIONS; i++) {
+                #pragma omp simd
+                for (int j = 0; j < CHAINS; j++)
+                    acc[j] = acc[j] * a + b;
+            }
+            T sum = T(0);
+            for (int j = 0; j < CHAINS; j++)
+                sum += acc[j];
+            #pragma omp critical
+            sink += sum;
+        }
+    }, 3);
+    return 2.0 * CHAINS * ITERATIONS * threads / ms / 1e6;
+}
+
+// Triad bandwidth over three arrays of bytes / 3 in total, repeated
+// until about 1 Gb has moved
+static double peak_gbs (int threads, double bytes) {
+    const long N = std::max(1024L, (long)(bytes / 3 / sizeof(double)));
+    int passes = (int)std::max(1L, (1L << 30) / (3 * N * (long)sizeof(double)));
+    vector<double> a(N), b(N, 1.0), c(N, 2.0);
+    double ms = median_ms([&]() {
+        #pragma omp parallel num_threads(threads)
+        {
+            std::pair<long, long> range = exec::chunk(N, omp_get_thread_num(), omp_get_num_threads());
+            for (int pass = 0; pass < passes; pass++) {
+                #pragma omp simd
+                for (long i = range.first; i < range.second; i++)
+                    a[i] = b[i] + 3.0 * c[i];
+            }
+        }
+    }, 5);
+    return 3.0 * N * sizeof(double) * passes / ms / 1e6;
+}
+
+static vector<Level> cache_levels (int threads) {
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE), l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    l2 = l2 > 0 ? l2 : (1L << 20);
+    l3 = l3 > 0 ? l3 : (32L << 20);
+    return {
+        { "L2", (double)l2, peak_gbs(threads, l2 / 2) },
+        { "L3", (double)l3, peak_gbs(threads, l3 / 2) },
+        { "memory", INFINITY, peak_gbs(threads, 4.0 * l3) },
+    };
+}
+
+static std::string dims (int rows, int cols) {
+    return std::to_string(rows) + "x" + std::to_string(cols);
+}
+
+template <class T>
+static void run_type (const char *type, int repeats, const std::string &filter, vector<Result> &results) {
+    using M = BasicMatrix<T>;
+    const double s = sizeof(T);
+    auto add = [&](const std::string &op, const std::string &shape, double flops, double bytes, std::function<void ()> f) {
+        if (!filter.empty() && op != filter)
+            return;
+        results.push_back({ op, type, shape, median_ms(f, repeats), flops, bytes });
+    };
+
+    // Products: the model's forward and backward shapes, then a square sweep
+    struct Shape { int m, k, n; bool trans_a, trans_b; };
+    vector<Shape> products {
+        { 400, 3072, 512, false, false }, { 400, 512, 10, false, false },
+        { 3072, 400, 512, true, false }, { 400, 512, 3072, false, true },
+        { 512, 400, 10, true, false }, { 400, 10, 512, false, true },
+        { 64, 64, 64, false, false }, { 256, 256, 256, false, false }, { 1024, 1024, 1024, false, false },
+    };
+    for (auto p : products) {
+        M a = p.trans_a ? M(p.k, p.m).fill_rand(1) : M(p.m, p.k).fill_rand(1);
+        M b = p.trans_b ? M(p.n, p.k).fill_rand(2) : M(p.k, p.n).fill_rand(2);
+        M c;
+        std::string shape = std::to_string(p.m) + "x" + std::to_string(p.k) + "x" + std::to_string(p.n)
+                          + (p.trans_a ? "_tn" : (p.trans_b ? "_nt" : ""));
+        add("dot", shape, 2.0 * p.m * p.k * p.n, s * ((double)p.m * p.k + (double)p.k * p.n + (double)p.m * p.n),
+            [&]() { c = a.dot(b, p.trans_a, p.trans_b); });
+    }
+
+    // Layout and elementwise kernels over activations, weights and a large square
+    vector<std::pair<int, int>> shapes { { 400, 3072 }, { 3072, 512 }, { 400, 512 }, { 400, 10 }, { 2048, 2048 } };
+    for (auto shape : shapes) {
+        int rows = shape.first, cols = shape.second;
+        double n = (double)rows * cols;
+        std::string name = dims(rows, cols);
+        M x = M(rows, cols).fill_rand(3), y = M(rows, cols).fill_rand(4), z;
+        M bias = M(1, cols).fill_rand(5);
+        M positive = x * x + 1.0;
+
+        add("T", name, 0, 2 * s * n, [&]() { z = x.T(); });
+        add("add_bias", name, n, s * (2 * n + cols), [&]() { z = x + bias; });
+        add("axpy", name, 2 * n, 3 * s * n, [&]() { z = x * 0.5 + y; });
+        add("sum0", name, n, s * (n + cols), [&]() { z = x.sum(0); });
+        add("sum1", name, n, s * (n + rows), [&]() { z = x.sum(1); });
+        add("mean1", name, n, s * (n + rows), [&]() { z = x.mean(1); });
+        add("max1", name, n, s * (n + rows), [&]() { z = x.max(1); });
+        add("argmax1", name, n, s * (n + rows), [&]() { z = x.argmax(1); });
+        add("exp", name, 0, 2 * s * n, [&]() { z = x.exp(); });
+        add("log", name, 0, 2 * s * n, [&]() { z = positive.log(); });
+        add("fill_rand", name, 0, s * n, [&]() { z = M(rows, cols); z.fill_rand(6); });
+    }
+}
+
+int main (int argc, char * argv[]) {
+    int repeats = 5;
+    std::string json_path, filter;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            exec::set_num_threads(std::stoi(argv[++i]));
+        else if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else
+            repeats = std::stoi(arg);
+    }
+
+    int threads = exec::num_threads();
+    pin_threads();
+    Peaks peaks { peak_gflops<double>(threads), peak_gflops<float>(threads), cache_levels(threads) };
+    std::cout << std::fixed << std::setprecision(1) << "threads: " << threads << ", repeats: " << repeats
+              << ", peak: " << peaks.gflops_double << " GFLOPS double, " << peaks.gflops_float << " GFLOPS float";
+    for (auto &level : peaks.levels)
+        std::cout << ", " << level.name << " " << level.gbs << " GB/s";
+    std::cout << "\n";
+
+    vector<Result> results;
+    run_type<double>("double", repeats, filter, results);
+    run_type<float>("float", repeats, filter, results);
+
+    // Share of the roofline bound, by bandwidth alone without a flop count
+    auto roofline = [&](const Result &r) {
+        double peak = r.type == "float" ? peaks.gflops_float : peaks.gflops_double;
+        double bandwidth = peaks.gbs(r.bytes);
+        if (r.flops == 0)
+            return r.bytes / r.ms / 1e6 / bandwidth;
+        return (r.flops / r.ms / 1e6) / std::min(peak, r.flops / r.bytes * bandwidth);
+    };
+
+    std::cout << std::left << std::setw(11) << "op" << std::setw(8) << "type" << std::setw(20) << "shape"
+              << std::right << std::setw(11) << "ms" << std::setw(10) << "GFLOPS" << std::setw(10) << "GB/s"
+              << std::setw(10) << "flop/B" << std::setw(10) << "roofline" << "\n";
+    for (auto &r : results) {
+        std::cout << std::left << std::setw(11) << r.op << std::setw(8) << r.type << std::setw(20) << r.shape
+                  << std::right << std::fixed << std::setprecision(3) << std::setw(11) << r.ms
+                  << std::setprecision(2) << std::setw(10);
+        if (r.flops > 0)
+            std::cout << r.flops / r.ms / 1e6;
+        else
+            std::cout << "-";
+        std::cout << std::setw(10) << r.bytes / r.ms / 1e6 << std::setw(10) << r.flops / r.bytes
+                  << std::setw(9) << 100 * roofline(r) << "%\n";
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream out(json_path);
+        out << std::setprecision(6) << "{\n  \"threads\": " << threads << ", \"repeats\": " << repeats
+            << ",\n  \"peak\": {\"gflops_double\": " << peaks.gflops_double << ", \"gflops_float\": "
+            << peaks.gflops_float;
+        for (auto &level : peaks.levels)
+            out << ", \"gbs_" << level.name << "\": " << level.gbs;
+        out << "},\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            auto &r = results[i];
+            out << "    {\"op\": \"" << r.op << "\", \"type\": \"" << r.type << "\", \"shape\": \"" << r.shape
+                << "\", \"ms\": " << r.ms << ", \"gflops\": " << r.flops / r.ms / 1e6
+                << ", \"gbs\": " << r.bytes / r.ms / 1e6 << ", \"roofline\": " << roofline(r) << "}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+        std::cout << "results written to " << json_path << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <string>
+#include <functional>
+#include <omp.h>
+#include "../MatrixLib/Matrix.hpp"
+
+/***********************************************************
+ * MathBench compares the vectorized Matrix::exp, log, sqrt
+ * and operator ^ with the scalar libm loop they replaced, in
+ * elements per second, and measures their max error in ULP
+ * against a higher precision reference (long double for
+ * double, double for float) over the given input ranges.
+ * Usage: ./math_bench.x86_64 [repeats]
+ **********************************************************/
+
+template <class F>
+static double time_ms (F f, int repeats) {
+    f();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repeats; r++)
+        f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0 / repeats;
+}
+
+// Distance between value and reference in units of the last place of T
+template <class T, class R>
+static double ulp_error (T value, R reference) {
+    if (std::isnan(reference) || std::isnan((R)value))
+        return (std::isnan(reference) && std::isnan((R)value)) ? 0.0 : INFINITY;
+    if (std::isinf(reference) || std::isinf((R)value))
+        return ((R)value == reference) ? 0.0 : INFINITY;
+    T rounded = (T)reference;
+    R ulp = (R)std::nextafter(std::fabs(rounded), (T)INFINITY) - (R)std::fabs(rounded);
+    if (ulp == 0 || std::isinf(ulp))
+        ulp = (R)std::numeric_limits<T>::denorm_min();
+    return (double)(std::fabs((R)value - reference) / ulp);
+}
+
+struct Case {
+    std::string name;
+    double low, high; //input range
+    bool log_scale; //inputs are 2^u for u uniform in [low, high]
+};
+
+template <class T, class R>
+static void run (const char *type, const Case &c, int repeats,
+                 std::function<BasicMatrix<T> (const BasicMatrix<T> &)> vectorized,
+                 std::function<T (T)> scalar, std::function<R (R)> reference) {
+    const int rows = 1000, cols = 1000;
+    BasicMatrix<T> x(rows, cols);
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(c.low, c.high);
+    T *px = x.data();
+    for (long i = 0; i < (long)rows * cols; i++)
+        px[i] = (T)(c.log_scale ? std::exp2(dist(gen)) : dist(gen));
+
+    BasicMatrix<T> y_old(rows, cols), y_new(rows, cols);
+    T *py_old = y_old.data();
+    double old_ms = time_ms([&]() {
+        #pragma omp parallel for
+        for (long i = 0; i < (long)rows * cols; i++)
+            py_old[i] = scalar(px[i]);
+    }, repeats);
+    double new_ms = time_ms([&]() { y_new = vectorized(x); }, repeats);
+
+    double max_ulp = 0.0;
+    const T *py_new = y_new.data();
+    for (long i = 0; i < (long)rows * cols; i++)
+        max_ulp = std::max(max_ulp, ulp_error<T, R>(py_new[i], reference((R)px[i])));
+
+    double elements = (double)rows * cols;
+    std::cout << std::left << std::setw(8) << type << std::setw(30) << c.name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(14) << elements / old_ms / 1e3
+              << std::setw(14) << elements / new_ms / 1e3 << std::setw(9) << old_ms / new_ms << "x"
+              << std::setprecision(2) << std::setw(10) << max_ulp << "\n";
+}
+
+template <class T, class R>
+static void run_all (const char *type, int repeats, double exp_low, double exp_high, double log_range) {
+    using M = BasicMatrix<T>;
+    run<T, R>(type, { "exp " + std::to_string((int)exp_low) + ".." + std::to_string((int)exp_high), exp_low, exp_high, false },
+              repeats, [](const M &m) { return m.exp(); }, [](T v) { return (T)std::exp(v); }, [](R v) { return std::exp(v); });
+    run<T, R>(type, { "exp -1..1", -1, 1, false },
+              repeats, [](const M &m) { return m.exp(); }, [](T v) { return (T)std::exp(v); }, [](R v) { return std::exp(v); });
+    run<T, R>(type, { "log 2^-" + std::to_string((int)log_range) + "..2^" + std::to_string((int)log_range), -log_range, log_range, true },
+              repeats, [](const M &m) { return m.log(); }, [](T v) { return (T)std::log(v); }, [](R v) { return std::log(v); });
+    run<T, R>(type, { "log 0.5..2", 0.5, 2, false },
+              repeats, [](const M &m) { return m.log(); }, [](T v) { return (T)std::log(v); }, [](R v) { return std::log(v); });
+    run<T, R>(type, { "sqrt 0..1e6", 0, 1e6, false },
+              repeats, [](const M &m) { return m.sqrt(); }, [](T v) { return (T)std::sqrt(v); }, [](R v) { return std::sqrt(v); });
+    run<T, R>(type, { "x ^ 2 -10..10", -10, 10, false },
+              repeats, [](const M &m) { return m ^ 2.0; }, [](T v) { return (T)std::pow(v, (T)2); }, [](R v) { return std::pow(v, (R)2); });
+    run<T, R>(type, { "x ^ 7 -10..10", -10, 10, false },
+              repeats, [](const M &m) { return m ^ 7.0; }, [](T v) { return (T)std::pow(v, (T)7); }, [](R v) { return std::pow(v, (R)7); });
+    run<T, R>(type, { "x ^ -3 0.1..10", 0.1, 10, false },
+              repeats, [](const M &m) { return m ^ -3.0; }, [](T v) { return (T)std::pow(v, (T)-3); }, [](R v) { return std::pow(v, (R)-3); });
+}
+
+int main (int argc, char * argv[]) {
+    int repeats = (argc > 1) ? std::stoi(argv[1]) : 5;
+
+    std::cout << "threads: " << omp_get_max_threads() << ", repeats: " << repeats << ", 10^6 elements\n";
+    std::cout << std::left << std::setw(8) << "type" << std::setw(30) << "function, input range" << std::right
+              << std::setw(14) << "libm Melem/s" << std::setw(14) << "vec Melem/s" << std::setw(10) << "speedup"
+              << std::setw(10) << "max ULP" << "\n";
+
+    run_all<double, long double>("double", repeats, -745, 709, 1070);
+    run_all<float, double>("float", repeats, -103, 88, 140);
+
+    return 0;
+}
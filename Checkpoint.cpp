@@ -0,0 +1,356 @@
+#include "NeuralNet.hpp"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <typeinfo>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+    const char MAGIC[8] = { 'N', 'N', 'C', 'K', 'P', 'T', '\0', '\0' };
+    const int MAX_LAYERS = 64;
+    enum LayerKind : int32_t { FC = 0, RELU = 1 };
+
+    struct LayerEntry {
+        int32_t kind;
+        int32_t rows, cols; //FC weights
+        int32_t relu; //FC with a fused ReLU
+    };
+    // First page of a checkpoint, offsets are in bytes from the start of the file
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t element_size; //4 float, 8 double
+        int64_t values_offset;
+        int64_t values_size; //elements of the packed values
+        int64_t state_offset;
+        int64_t state_stride;
+        int64_t state_buffers; //optimizer buffers of values_size elements
+        int64_t optimizer_steps;
+        double reg;
+        int64_t epoch;
+        int32_t val_sample;
+        int32_t reserved;
+        double learning_rate;
+        double loss_scale;
+        rng::Philox::State folds;
+        rng::Philox::State rng;
+        int32_t layers;
+        LayerEntry layer[MAX_LAYERS];
+    };
+
+    long round_up (long bytes, long page) {
+        return (bytes + page - 1) / page * page;
+    }
+
+    // Whole file mapped read-only, or copy-on-write if writable, unmapped by the last owner
+    std::shared_ptr<void> map_file (const std::string &path, size_t &size, bool writable = false) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Error: Can't open the checkpoint " + path + "!\n");
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(Header)) {
+            close(fd);
+            throw std::runtime_error("Error: " + path + " isn't a checkpoint!\n");
+        }
+        size = info.st_size;
+        void *data = writable ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+                              : mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Error: Can't map the checkpoint " + path + "!\n");
+        return std::shared_ptr<void>(data, [size](void *data) { munmap(data, size); });
+    }
+
+    const Header &check_header (const std::shared_ptr<void> &file, size_t size, const std::string &path) {
+        const Header &header = *static_cast<const Header *>(file.get());
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("Error: " + path + " isn't a checkpoint!\n");
+        if (header.version != nn::Checkpoint<double>::VERSION)
+            throw std::runtime_error("Error: Checkpoint version " + std::to_string(header.version) + " of " + path
+                                     + " isn't supported!\n");
+        if ((header.element_size != sizeof(float) && header.element_size != sizeof(double))
+            || header.layers < 0 || header.layers > MAX_LAYERS
+            || (size_t)(header.values_offset + header.values_size * header.element_size) > size
+            || (size_t)(header.state_offset + header.state_buffers * header.state_stride) > size)
+            throw std::runtime_error("Error: The checkpoint " + path + " is damaged!\n");
+        return header;
+    }
+
+    // Converts n elements stored with the given size into T
+    template <class T>
+    void convert (const char *from, uint32_t element_size, T *to, long n) {
+        if (element_size == sizeof(T)) {
+            std::memcpy(to, from, n * sizeof(T));
+            return;
+        }
+        exec::parallel_for(n, exec::ELEMENTWISE, [&](long begin, long end) {
+            if (element_size == sizeof(float)) {
+                const float *source = reinterpret_cast<const float *>(from);
+                for (long i = begin; i < end; i++)
+                    to[i] = T(source[i]);
+            } else {
+                const double *source = reinterpret_cast<const double *>(from);
+                for (long i = begin; i < end; i++)
+                    to[i] = T(source[i]);
+            }
+        });
+    }
+
+    void write_all (int fd, const void *data, size_t bytes, off_t offset) {
+        const char *from = static_cast<const char *>(data);
+        while (bytes > 0) {
+            ssize_t written = pwrite(fd, from, bytes, offset);
+            if (written <= 0)
+                throw std::runtime_error("short write");
+            from += written;
+            offset += written;
+            bytes -= written;
+        }
+    }
+}
+
+template <class T>
+nn::Checkpoint<T>::Checkpoint () {
+    static_assert(sizeof(Header) <= PAGE, "The checkpoint header has to fit in a page");
+    this->worker = std::thread(&Checkpoint::run, this);
+}
+
+template <class T>
+nn::Checkpoint<T>::~Checkpoint () {
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->changed.wait(guard, [&] { return !this->pending; });
+        this->stopping = true;
+    }
+    this->changed.notify_all();
+    this->worker.join();
+}
+
+template <class T>
+void nn::Checkpoint<T>::save (const std::string &path, Model<T> &model, Optim<T> *optim, const TrainingState &progress) {
+    // The snapshot buffers belong to the writer until the previous checkpoint is out
+    auto start = std::chrono::high_resolution_clock::now();
+    this->wait();
+    this->stall_seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.element_size = sizeof(T);
+    header.reg = model.reg;
+    header.epoch = progress.epoch;
+    header.val_sample = progress.val_sample;
+    header.learning_rate = progress.learning_rate;
+    header.loss_scale = progress.loss_scale;
+    header.folds = progress.folds;
+    header.rng = progress.rng;
+    for (auto it : model.layers) {
+        if (header.layers == MAX_LAYERS)
+            throw std::runtime_error("Error: Too many layers for a checkpoint!\n");
+        LayerEntry &entry = header.layer[header.layers++];
+        if (typeid(*it) == typeid(FCLayer<T>)) {
+            FCLayer<T> *fc = (FCLayer<T> *)it;
+            auto shape = fc->get_params().first->value.shape();
+            entry = LayerEntry{ FC, std::get<0>(shape), std::get<1>(shape), fc->has_relu() };
+        } else if (typeid(*it) == typeid(ReLULayer<T>)) {
+            entry = LayerEntry{ RELU, 0, 0, 0 };
+        } else {
+            throw std::runtime_error("Error: Only FCLayer and ReLULayer models can be saved!\n");
+        }
+    }
+
+    // Values, then the optimizer state if it has any yet
+    const Parameter<T> &packed = model.packed_params();
+    long size = std::get<1>(packed.value.shape());
+    header.values_size = size;
+    header.values_offset = PAGE;
+    header.state_offset = round_up(PAGE + size * sizeof(T), PAGE);
+    vector<Matrix *> buffers = optim ? optim->state() : vector<Matrix *>();
+    bool started = !buffers.empty() && std::get<1>(buffers[0]->shape()) == size;
+    header.state_buffers = started ? (long)buffers.size() : 0;
+    header.state_stride = round_up(size * sizeof(T), PAGE);
+    header.optimizer_steps = optim ? optim->steps() : 0;
+
+    this->path = path;
+    this->header.assign((const char *)&header, (const char *)&header + sizeof(header));
+    this->values.resize(size);
+    std::memcpy(this->values.data(), packed.value.data(), size * sizeof(T));
+    this->state.resize(header.state_buffers * size);
+    for (long b = 0; b < header.state_buffers; b++)
+        std::memcpy(this->state.data() + b * size, buffers[b]->data(), size * sizeof(T));
+    this->state_stride = header.state_stride;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->pending = true;
+    }
+    this->changed.notify_all();
+}
+
+template <class T>
+void nn::Checkpoint<T>::wait () {
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->changed.wait(guard, [&] { return !this->pending; });
+    if (!this->error.empty()) {
+        std::string message = this->error;
+        this->error.clear();
+        throw std::runtime_error(message);
+    }
+}
+
+template <class T>
+void nn::Checkpoint<T>::run () {
+    std::unique_lock<std::mutex> guard(this->lock);
+    while (true) {
+        this->changed.wait(guard, [&] { return this->stopping || this->pending; });
+        if (!this->pending)
+            return;
+        guard.unlock();
+        auto start = std::chrono::high_resolution_clock::now();
+        std::string failure;
+        try {
+            this->write();
+        } catch (const std::exception &e) {
+            failure = "Error: Can't write the checkpoint " + this->path + " (" + e.what() + ")!\n";
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        guard.lock();
+        this->write_seconds += seconds;
+        this->error = failure;
+        this->pending = false;
+        this->changed.notify_all();
+    }
+}
+
+template <class T>
+void nn::Checkpoint<T>::write () {
+    const Header &header = *reinterpret_cast<const Header *>(this->header.data());
+    std::string temporary = this->path + ".tmp";
+    int fd = open(temporary.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0)
+        throw std::runtime_error("open failed");
+    try {
+        // Sized first, the padding between the sections reads as zeros
+        long size = header.values_size;
+        if (ftruncate(fd, header.state_offset + header.state_buffers * header.state_stride) != 0)
+            throw std::runtime_error("ftruncate failed");
+        write_all(fd, this->header.data(), this->header.size(), 0);
+        write_all(fd, this->values.data(), size * sizeof(T), header.values_offset);
+        for (long b = 0; b < header.state_buffers; b++)
+            write_all(fd, this->state.data() + b * size, size * sizeof(T), header.state_offset + b * header.state_stride);
+        if (fsync(fd) != 0)
+            throw std::runtime_error("fsync failed");
+    } catch (...) {
+        close(fd);
+        unlink(temporary.c_str());
+        throw;
+    }
+    close(fd);
+    if (rename(temporary.c_str(), this->path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        throw std::runtime_error("rename failed");
+    }
+}
+
+template <class T>
+nn::Model<T> nn::Checkpoint<T>::load_model (const std::string &path, bool mapped, bool trainable) {
+    size_t size;
+    std::shared_ptr<void> file = map_file(path, size, mapped && trainable);
+    const Header &header = check_header(file, size, path);
+
+    // The values are the mapped pages, or converted into memory the model keeps
+    char *stored = static_cast<char *>(file.get()) + header.values_offset;
+    T *values = reinterpret_cast<T *>(stored);
+    std::shared_ptr<void> storage = file;
+    if (!mapped || header.element_size != sizeof(T)) {
+        values = new T[header.values_size];
+        storage = std::shared_ptr<void>(values, [](void *values) { delete[] static_cast<T *>(values); });
+        convert(stored, header.element_size, values, header.values_size);
+    }
+
+    // Layers over the packed layout of Model::pack, without a fill
+    const long ALIGN = Model<T>::PACK_ALIGN;
+    auto aligned = [&](long elements) { return (elements + ALIGN - 1) / ALIGN * ALIGN; };
+    Model<T> result;
+    result.reg = header.reg;
+    long offset = 0;
+    for (int i = 0; i < header.layers; i++) {
+        const LayerEntry &entry = header.layer[i];
+        Layer<T> *layer;
+        if (entry.kind == FC) {
+            long bias = offset + aligned((long)entry.rows * entry.cols), end = bias + aligned(entry.cols);
+            if (entry.rows <= 0 || entry.cols <= 0 || end > header.values_size)
+                throw std::runtime_error("Error: The checkpoint " + path + " is damaged!\n");
+            FCLayer<T> *fc = new FCLayer<T>(entry.rows, entry.cols, entry.relu != 0, values + offset, values + bias);
+            result.owned.emplace_back(fc);
+            layer = fc;
+            offset = end;
+        } else if (entry.kind == RELU) {
+            ReLULayer<T> *relu = new ReLULayer<T>();
+            result.owned.emplace_back(relu);
+            layer = relu;
+        } else {
+            throw std::runtime_error("Error: The checkpoint " + path + " is damaged!\n");
+        }
+        result.layers.push_back(layer);
+    }
+    if (offset != header.values_size)
+        throw std::runtime_error("Error: The checkpoint " + path + " is damaged!\n");
+    result.mark_sparse_inputs();
+    result.pack(values, trainable);
+    result.storage = storage;
+    return result;
+}
+
+template <class T>
+nn::TrainingState nn::Checkpoint<T>::load (const std::string &path, Model<T> &model, Optim<T> *optim) {
+    size_t size;
+    std::shared_ptr<void> file = map_file(path, size);
+    const Header &header = check_header(file, size, path);
+
+    // Same layers, in the same order
+    bool same = header.layers == (int)model.layers.size();
+    for (int i = 0; same && i < header.layers; i++) {
+        const LayerEntry &entry = header.layer[i];
+        Layer<T> *it = model.layers[i];
+        if (typeid(*it) == typeid(FCLayer<T>)) {
+            FCLayer<T> *fc = (FCLayer<T> *)it;
+            auto shape = fc->get_params().first->value.shape();
+            same = entry.kind == FC && entry.rows == std::get<0>(shape) && entry.cols == std::get<1>(shape)
+                   && (entry.relu != 0) == fc->has_relu();
+        } else {
+            same = entry.kind == RELU && typeid(*it) == typeid(ReLULayer<T>);
+        }
+    }
+    Parameter<T> &packed = model.packed_params();
+    long elements = std::get<1>(packed.value.shape());
+    if (!same || elements != header.values_size)
+        throw std::runtime_error("Error: The checkpoint " + path + " doesn't match the model!\n");
+
+    const char *data = static_cast<const char *>(file.get());
+    convert(data + header.values_offset, header.element_size, packed.value.data(), elements);
+    if (optim) {
+        vector<Matrix *> buffers = optim->state();
+        if (header.state_buffers != 0 && header.state_buffers != (long)buffers.size())
+            throw std::runtime_error("Error: The optimizer state of " + path + " doesn't match the optimizer!\n");
+        for (long b = 0; b < header.state_buffers; b++) {
+            *buffers[b] = Matrix(1, (int)elements);
+            convert(data + header.state_offset + b * header.state_stride, header.element_size, buffers[b]->data(), elements);
+        }
+        optim->set_steps(header.optimizer_steps);
+    }
+    TrainingState progress;
+    progress.epoch = header.epoch;
+    progress.val_sample = header.val_sample;
+    progress.learning_rate = header.learning_rate;
+    progress.loss_scale = header.loss_scale;
+    progress.folds = header.folds;
+    progress.rng = header.rng;
+    return progress;
+}
+
+template class nn::Checkpoint<double>;
+template class nn::Checkpoint<float>;
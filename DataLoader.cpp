@@ -1,102 +1,116 @@
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
 #include "DataLoader.hpp"
 
 
-pair<vector<vector<double>>, vector<double>> DataLoader::load_dataset(const char* filename, pair<int, int> size) {
+template <class T>
+Dataset<T> DataLoader::load_dataset (const char* filename, pair<int, int> size) {
     // Open the file
     fin.open(filename, std::ios::binary);
     // Form the dataset of size of images x image_size
     int images = size.first, image_size = size.second;
-    // Create the matrices
-    vector<vector<double>> dataset;
-    dataset.resize(images, vector<double>(image_size));
-    vector<double> labels(images);
-    //Matrix labels = Matrix(1, images);
-    // Temporary variables, ifstream.read(...) requires char* whereas we
+    // Create the matrices, images are stored contiguously one per row
+    BasicMatrix<T> dataset(images, image_size);
+    BasicMatrix<T> labels(images, 1);
+    // Every record is an image followed by its label, the whole file
+    // is read at once. ifstream.read(...) requires char* whereas we
     // need colors to be unsigned char within the range from 0 to 255
-    char *temp = new char[image_size];
-    unsigned char *u_temp;
+    long record = image_size + 1;
+    vector<char> temp((size_t)images * record);
+    fin.read(temp.data(), temp.size());
+    const unsigned char *u_temp = reinterpret_cast<const unsigned char*>(temp.data());
+    fin.close();
 
-    for (int i = 0; i < images; i++){
-        // Reading the image
-        fin.read(temp, image_size);
-        u_temp = reinterpret_cast<unsigned char*>(temp);
-        #pragma omp parallel for shared(i, u_temp, dataset)
-        for (int j = 0; j < image_size; j++){
-            dataset[i][j] = (double)u_temp[j];
+    T *pixels = dataset.data();
+    T *marks = labels.data();
+    exec::parallel_for(images, exec::COPY, [&](long begin, long end) {
+        for (int i = begin; i < end; i++){
+            const unsigned char *src = u_temp + i * record;
+            T *dst = pixels + (long)i * image_size;
+            for (int j = 0; j < image_size; j++)
+                dst[j] = (T)src[j];
+            marks[i] = (T)src[image_size];
         }
-        
-        // Reading the label
-        fin.read(temp, 1);
-        u_temp = reinterpret_cast<unsigned char*>(temp);
-        labels[i] = (double)u_temp[0];
-    }
-    fin.close();
+    }, record);
 
-    return pair<vector<vector<double>>, vector<double>>(dataset, labels);
+    return Dataset<T>(std::move(dataset), std::move(labels));
 }
 
-pair<Matrix, Matrix> DataLoader::load_as_matrix (vector<vector<double>> &X, vector<double> &y, vector<int> &indices) {
-    vector<vector<double>> result_images(indices.size());
-    vector<vector<double>> result_labels(indices.size());
+template <class T, class U>
+void DataLoader::gather (const BasicMatrix<T> &X, const BasicMatrix<T> &y, const vector<int> &indices,
+                         BasicMatrix<U> &batch_X, BasicMatrix<U> &batch_y) {
+    int rows = (int)indices.size();
+    int cols = std::get<1>(X.shape());
+    if (batch_X.shape() != std::make_tuple(rows, cols))
+        batch_X = BasicMatrix<U>(rows, cols);
+    if (batch_y.shape() != std::make_tuple(rows, 1))
+        batch_y = BasicMatrix<U>(rows, 1);
 
-    for (int i = 0; i < (int)indices.size(); i++){
-        result_images[i] = X[indices[i]];
-        result_labels[i] = vector<double>{y[indices[i]]};
-    }
+    const T *images = X.data();
+    const T *labels = y.data();
+    U *batch_images = batch_X.data();
+    U *batch_labels = batch_y.data();
+    exec::parallel_for(rows, exec::COPY, [&](long begin, long end) {
+        for (int i = begin; i < end; i++){
+            const T *row = images + (long)indices[i] * cols;
+            std::copy(row, row + cols, batch_images + (long)i * cols);
+            batch_labels[i] = U(labels[indices[i]]);
+        }
+    }, cols);
+}
 
-    return pair<Matrix, Matrix>(Matrix(result_images), Matrix(result_labels));
+template <class T>
+Dataset<T> DataLoader::load_as_matrix (const BasicMatrix<T> &X, const BasicMatrix<T> &y, const vector<int> &indices) {
+    Dataset<T> result;
+    gather(X, y, indices, result.first, result.second);
+    return result;
 }
 
-void DataLoader::prepare_dataset (vector<vector<double>> &Train, vector<vector<double>> &Test) {
+template <class T>
+void DataLoader::prepare_dataset (BasicMatrix<T> &Train, BasicMatrix<T> &Test) {
     
     auto t1 = std::chrono::high_resolution_clock::now();
-    // Cast the Train colors to the 0.0..1.0 ratio
-    for (int i = 0; i < (int)Train.size(); i++){
-        int size = (int)Train[i].size();
-        #pragma omp parallel for shared(i, size, Train)
-        for (int j = 0; j < size; j++)
-            Train[i][j] /= 255.0;
-    }
+    long train_size = (long)std::get<0>(Train.shape()) * std::get<1>(Train.shape());
+    long test_size = (long)std::get<0>(Test.shape()) * std::get<1>(Test.shape());
+    T *train = Train.data();
+    T *test = Test.data();
 
-    // Cast the Test colors to the 0.0..1.0 ratio
-    for (int i = 0; i < (int)Test.size(); i++){
-        int size = (int)Test[i].size();
-        #pragma omp parallel for shared(i, size, Test)
-        for (int j = 0; j < size; j++)
-            Test[i][j] /= 255.0;
-    }
+    // Compute mean value of the Train colors cast to the 0.0..1.0 ratio
+    double mean = exec::parallel_reduce(train_size, exec::REDUCTION, 0.0, [&](long begin, long end) {
+        double sum = 0.0;
+        for (long i = begin; i < end; i++)
+            sum += (double)train[i];
+        return sum;
+    }, [](double a, double b) { return a + b; });
+    mean /= 255.0 * (double)train_size;
 
-    // Compute mean value
-    double mean = 0.0;
-    for (auto it_1 : Train) {
-        int size = (int)it_1.size();
-        #pragma omp parallel for shared(it_1, size) reduction(+: mean)
-        for (int i = 0; i < size; i++){
-            mean += it_1[i];
-        }
-    }
+    // Cast the colors to the 0.0..1.0 ratio and normalize Train and Test
+    exec::parallel_for(train_size, exec::ELEMENTWISE, [&](long begin, long end) {
+        for (long i = begin; i < end; i++)
+            train[i] = (T)((double)train[i] / 255.0 - mean);
+    });
 
-    mean /= (double)(Train.size() * Train[0].size());
-    
-    // Normalize Train
-    for (int i = 0; i < (int)Train.size(); i++){
-        int size = (int)Train[i].size();
-        #pragma omp parallel for shared(i, size, Train)
-        for (int j = 0; j < size; j++)
-            Train[i][j] -= mean;
-    }
+    exec::parallel_for(test_size, exec::ELEMENTWISE, [&](long begin, long end) {
+        for (long i = begin; i < end; i++)
+            test[i] = (T)((double)test[i] / 255.0 - mean);
+    });
 
-    // Normalize Test
-    for (int i = 0; i < (int)Test.size(); i++){
-        int size = (int)Test[i].size();
-        #pragma omp parallel for shared(i, size, Train)
-        for (int j = 0; j < size; j++)
-            Test[i][j] -= mean;
-    }
     auto t2 = std::chrono::high_resolution_clock::now();
     double dur = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
     std::cout << "Dataset prepared for " << dur / 1000.0 << " milliseconds\n";
 }
+
+template Dataset<double> DataLoader::load_dataset<double> (const char*, pair<int, int>);
+template Dataset<float> DataLoader::load_dataset<float> (const char*, pair<int, int>);
+template void DataLoader::gather<double> (const BasicMatrix<double> &, const BasicMatrix<double> &, const vector<int> &,
+                                          BasicMatrix<double> &, BasicMatrix<double> &);
+template void DataLoader::gather<float> (const BasicMatrix<float> &, const BasicMatrix<float> &, const vector<int> &,
+                                         BasicMatrix<float> &, BasicMatrix<float> &);
+template void DataLoader::gather<double, float> (const BasicMatrix<double> &, const BasicMatrix<double> &, const vector<int> &,
+                                                 BasicMatrix<float> &, BasicMatrix<float> &);
+template Dataset<double> DataLoader::load_as_matrix<double> (const BasicMatrix<double> &, const BasicMatrix<double> &, const vector<int> &);
+template Dataset<float> DataLoader::load_as_matrix<float> (const BasicMatrix<float> &, const BasicMatrix<float> &, const vector<int> &);
+template void DataLoader::prepare_dataset<double> (BasicMatrix<double> &, BasicMatrix<double> &);
+template void DataLoader::prepare_dataset<float> (BasicMatrix<float> &, BasicMatrix<float> &);
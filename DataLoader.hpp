@@ -6,11 +6,22 @@
 using std::vector;
 using std::pair;
 
+// Images (one per row) and labels (one column) of a dataset
+template <class T>
+using Dataset = pair<BasicMatrix<T>, BasicMatrix<T>>;
+
 class DataLoader {
 private:
     std::ifstream fin;
 public:
-    pair<vector<vector<double>>, vector<double>> load_dataset(const char*, pair<int, int>);
-    static pair<Matrix, Matrix> load_as_matrix (vector<vector<double>> &, vector<double> &, vector<int> &);
-    static void prepare_dataset (vector<vector<double>> &, vector<vector<double>> &);
-};
\ No newline at end of file
+    template <class T = double>
+    Dataset<T> load_dataset (const char*, pair<int, int>);
+    // Copies the rows of X and y listed in indices into the given batch matrices,
+    // which are only reallocated if their shape doesn't match, converted to U
+    template <class T = double, class U = T>
+    static void gather (const BasicMatrix<T> &, const BasicMatrix<T> &, const vector<int> &, BasicMatrix<U> &, BasicMatrix<U> &);
+    template <class T = double>
+    static Dataset<T> load_as_matrix (const BasicMatrix<T> &, const BasicMatrix<T> &, const vector<int> &);
+    template <class T = double>
+    static void prepare_dataset (BasicMatrix<T> &, BasicMatrix<T> &);
+};
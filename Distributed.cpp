@@ -0,0 +1,334 @@
+#include "Distributed.hpp"
+#include "MatrixLib/Parallel.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <mutex>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+namespace {
+    // Start of the segment, every mailbox follows on its own cache lines
+    struct Header {
+        std::atomic<int> attached;
+        std::atomic<int> arrived; //barrier
+        std::atomic<uint64_t> generation;
+        std::atomic<int> lost; //set once a rank exited, the waits for it throw
+    };
+    struct Mailbox {
+        alignas(64) std::atomic<uint64_t> sent; //messages written by the previous rank
+        alignas(64) std::atomic<uint64_t> taken; //messages read by the owner
+        alignas(64) char data[1];
+    };
+    const size_t HEADER_BYTES = 4096;
+    const size_t MAILBOX_STRIDE = offsetof(Mailbox, data) + dist::MAILBOX_BYTES;
+
+    struct Child {
+        pid_t pid;
+        bool reaped; //exited, with status
+        int status;
+    };
+    std::vector<Child> children; //of the launcher
+    std::mutex children_lock;
+    pid_t launcher = 0; //parent of a spawned rank
+
+    Header *header (void *segment) {
+        return static_cast<Header *>(segment);
+    }
+    Mailbox *mailbox (void *segment, int rank) {
+        return reinterpret_cast<Mailbox *>(static_cast<char *>(segment) + HEADER_BYTES + rank * MAILBOX_STRIDE);
+    }
+
+    // Pins the calling process to the rank's block of cpus, left alone if there are more ranks than cpus
+    void pin (int rank, int ranks) {
+        cpu_set_t all;
+        if (sched_getaffinity(0, sizeof(all), &all) != 0)
+            return;
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &all))
+                cpus.push_back(cpu);
+        if ((int)cpus.size() < ranks)
+            return;
+        auto block = exec::chunk((long)cpus.size(), rank, ranks);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (long i = block.first; i < block.second; i++)
+            CPU_SET(cpus[i], &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    // The launcher reaps the ranks that exited and flags them in the segment,
+    // a spawned rank also sees the launcher go as a new parent
+    bool peer_lost (Header *h) {
+        {
+            std::lock_guard<std::mutex> guard(children_lock);
+            for (auto &child : children) {
+                if (!child.reaped && waitpid(child.pid, &child.status, WNOHANG) == child.pid) {
+                    child.reaped = true;
+                    h->lost.store(1);
+                }
+            }
+        }
+        return h->lost.load() != 0 || (launcher != 0 && getppid() != launcher);
+    }
+
+    template <class F>
+    void spin_until (Header *h, F ready) {
+        const long CHECK_EVERY = 1024; //spins between the liveness checks
+        for (long spins = 1; !ready(); spins++) {
+            if (spins % CHECK_EVERY == 0 && peer_lost(h) && !ready())
+                throw std::runtime_error("Error: A rank exited while the others were waiting for it!\n");
+            sched_yield();
+        }
+    }
+}
+
+int dist::launch (int ranks, char *argv[]) {
+    if (getenv("NN_RANK"))
+        return atoi(getenv("NN_RANK"));
+    if (ranks <= 1)
+        return 0;
+
+    // Segment for the header and one mailbox per rank, zeroed by ftruncate
+    std::string name = "/nn_" + std::to_string(getpid());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        throw std::runtime_error("Error: Can't create the shared memory segment " + name + "!\n");
+    if (ftruncate(fd, HEADER_BYTES + ranks * MAILBOX_STRIDE) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Error: Can't size the shared memory segment " + name + "!\n");
+    }
+    close(fd);
+
+    std::string size = std::to_string(ranks);
+    setenv("NN_WORLD_SIZE", size.c_str(), 1);
+    setenv("NN_SHM", name.c_str(), 1);
+    for (int rank = 1; rank < ranks; rank++) {
+        // Environment of the child, built before the fork which only pins and execs
+        std::string rank_var = "NN_RANK=" + std::to_string(rank);
+        std::vector<char *> env;
+        for (char **it = environ; *it; it++)
+            env.push_back(*it);
+        env.push_back(const_cast<char *>(rank_var.c_str()));
+        env.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid < 0)
+            throw std::runtime_error("Error: Can't start rank " + std::to_string(rank) + "!\n");
+        if (pid == 0) {
+            pin(rank, ranks);
+            execve("/proc/self/exe", argv, env.data());
+            _exit(127);
+        }
+        children.push_back({ pid, false, 0 });
+    }
+    setenv("NN_RANK", "0", 1);
+    pin(0, ranks);
+    // The OpenMP pool of the launcher was sized before the pinning
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        exec::set_num_threads(std::max(1, CPU_COUNT(&set)));
+    return 0;
+}
+
+bool dist::finish () {
+    bool ok = true;
+    std::lock_guard<std::mutex> guard(children_lock);
+    for (auto &child : children) {
+        if (!child.reaped && waitpid(child.pid, &child.status, 0) < 0)
+            ok = false;
+        else if (!WIFEXITED(child.status) || WEXITSTATUS(child.status) != 0)
+            ok = false;
+    }
+    children.clear();
+    return ok;
+}
+
+dist::Communicator::Communicator () {
+    if (!getenv("NN_RANK") || !getenv("NN_WORLD_SIZE") || !getenv("NN_SHM"))
+        return;
+    this->rank_id = atoi(getenv("NN_RANK"));
+    this->ranks = atoi(getenv("NN_WORLD_SIZE"));
+    if (this->rank_id != 0)
+        launcher = getppid();
+    const char *name = getenv("NN_SHM");
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0)
+        throw std::runtime_error(std::string("Error: Can't open the shared memory segment ") + name + "!\n");
+    this->segment_size = HEADER_BYTES + this->ranks * MAILBOX_STRIDE;
+    this->segment = mmap(nullptr, this->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (this->segment == MAP_FAILED)
+        throw std::runtime_error(std::string("Error: Can't map the shared memory segment ") + name + "!\n");
+
+    // Once every rank is in, the name isn't needed anymore
+    header(this->segment)->attached.fetch_add(1);
+    this->barrier();
+    if (this->rank_id == 0)
+        shm_unlink(name);
+    this->worker = std::thread(&Communicator::run, this);
+}
+
+dist::Communicator::~Communicator () {
+    if (!this->segment)
+        return;
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->changed.wait(guard, [&] { return this->tasks.empty() && !this->busy; });
+    }
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->changed.notify_all();
+    this->worker.join();
+    munmap(this->segment, this->segment_size);
+}
+
+void dist::Communicator::barrier () {
+    if (this->ranks == 1)
+        return;
+    // Generation counting barrier, the last rank to arrive opens it
+    Header *h = header(this->segment);
+    uint64_t generation = ++this->barrier_generation;
+    if (h->arrived.fetch_add(1) + 1 == this->ranks) {
+        h->arrived.store(0);
+        h->generation.store(generation, std::memory_order_release);
+    } else {
+        spin_until(h, [&] { return h->generation.load(std::memory_order_acquire) >= generation; });
+    }
+}
+
+void dist::Communicator::send (int to, const void *data, size_t bytes) {
+    Mailbox *box = mailbox(this->segment, to);
+    // The previous message has to be taken first
+    uint64_t sent = box->sent.load(std::memory_order_relaxed);
+    spin_until(header(this->segment), [&] { return box->taken.load(std::memory_order_acquire) == sent; });
+    std::memcpy(box->data, data, bytes);
+    box->sent.store(sent + 1, std::memory_order_release);
+}
+
+template <class T>
+void dist::Communicator::receive (T *data, long n, bool add) {
+    Mailbox *box = mailbox(this->segment, this->rank_id);
+    uint64_t taken = box->taken.load(std::memory_order_relaxed);
+    spin_until(header(this->segment), [&] { return box->sent.load(std::memory_order_acquire) > taken; });
+    const T *message = reinterpret_cast<const T *>(box->data);
+    if (add) {
+        #pragma omp simd
+        for (long i = 0; i < n; i++)
+            data[i] += message[i];
+    } else {
+        std::memcpy(data, message, n * sizeof(T));
+    }
+    box->taken.store(taken + 1, std::memory_order_release);
+}
+
+// Ring all-reduce of one bucket: chunk c of the bucket travels the ring
+// collecting the sums, then the reduced chunks travel it once more
+template <class T>
+void dist::Communicator::ring (T *data, long n) {
+    int next = (this->rank_id + 1) % this->ranks;
+    auto chunk = [&](int c) { return exec::chunk(n, ((c % this->ranks) + this->ranks) % this->ranks, this->ranks); };
+    for (int step = 0; step < this->ranks - 1; step++) {
+        auto out = chunk(this->rank_id - step), in = chunk(this->rank_id - step - 1);
+        this->send(next, data + out.first, (out.second - out.first) * sizeof(T));
+        this->receive(data + in.first, in.second - in.first, true);
+    }
+    for (int step = 0; step < this->ranks - 1; step++) {
+        auto out = chunk(this->rank_id + 1 - step), in = chunk(this->rank_id - step);
+        this->send(next, data + out.first, (out.second - out.first) * sizeof(T));
+        this->receive(data + in.first, in.second - in.first, false);
+    }
+}
+
+template <class T>
+void dist::Communicator::reduce_buckets (T *data, long n) {
+    auto start = std::chrono::high_resolution_clock::now();
+    const long BUCKET = (long)(MAILBOX_BYTES / sizeof(T)) * this->ranks;
+    for (long begin = 0; begin < n; begin += BUCKET)
+        this->ring(data + begin, std::min(BUCKET, n - begin));
+    auto end = std::chrono::high_resolution_clock::now();
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->busy_seconds += std::chrono::duration<double>(end - start).count();
+}
+
+template <class T>
+void dist::Communicator::allreduce_async (T *data, long n, T scale) {
+    if (this->ranks == 1) {
+        if (scale != T(1))
+            for (long i = 0; i < n; i++)
+                data[i] *= scale;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->tasks.push_back([this, data, n, scale] {
+            if (scale != T(1)) {
+                #pragma omp simd
+                for (long i = 0; i < n; i++)
+                    data[i] *= scale;
+            }
+            this->reduce_buckets(data, n);
+        });
+    }
+    this->changed.notify_all();
+}
+
+template <class T>
+void dist::Communicator::allreduce (T *data, long n) {
+    this->allreduce_async(data, n);
+    this->wait();
+}
+
+void dist::Communicator::wait () {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->changed.wait(guard, [&] { return this->tasks.empty() && !this->busy; });
+    this->wait_seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    if (!this->error.empty()) {
+        std::string message = this->error;
+        this->error.clear();
+        throw std::runtime_error(message);
+    }
+}
+
+void dist::Communicator::run () {
+    std::unique_lock<std::mutex> guard(this->lock);
+    while (true) {
+        this->changed.wait(guard, [&] { return this->stopping || !this->tasks.empty(); });
+        if (this->tasks.empty())
+            return;
+        std::function<void()> task = std::move(this->tasks.front());
+        this->tasks.pop_front();
+        this->busy = true;
+        guard.unlock();
+        std::string failure;
+        try {
+            task();
+        } catch (const std::exception &e) {
+            failure = e.what();
+        }
+        guard.lock();
+        // The queued all-reduces can't complete without the lost rank
+        if (!failure.empty()) {
+            this->error = failure;
+            this->tasks.clear();
+        }
+        this->busy = false;
+        this->changed.notify_all();
+    }
+}
+
+template void dist::Communicator::allreduce<double> (double *, long);
+template void dist::Communicator::allreduce<float> (float *, long);
+template void dist::Communicator::allreduce_async<double> (double *, long, double);
+template void dist::Communicator::allreduce_async<float> (float *, long, float);
@@ -0,0 +1,100 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**********************************************************
+ * dist - multi-process training on one node. The launcher
+ * starts the ranks as copies of the running program, they
+ * meet in a POSIX shared memory segment and sum their
+ * gradients with a ring all-reduce through it.
+ * --------------------------------------------------------
+ * Every rank owns a mailbox of MAILBOX_BYTES in the segment,
+ * a message is a chunk of a bucket sent to the next rank of
+ * the ring. An all-reduce of n elements is cut into buckets of
+ * size * MAILBOX_BYTES, each bucket is reduce-scattered and
+ * all-gathered in 2 * (size - 1) steps, so every rank moves
+ * about 2 * n elements whatever the number of ranks.
+ * --------------------------------------------------------
+ * Notes:
+ *    -The ranks find the segment through the NN_RANK,
+ *    NN_WORLD_SIZE and NN_SHM environment variables set by
+ *    launch(), a process without them is a single rank.
+ *    -Ranks are pinned to equal contiguous blocks of the
+ *    CPUs, i.e. one per socket or NUMA domain when the CPUs
+ *    are numbered that way.
+ *    -Waits spin with sched_yield(), the ranks are expected
+ *    to have CPUs of their own. A wait throws once a rank is
+ *    gone: the launcher reaps the ranks that exit and flags
+ *    it in the segment, the spawned ranks watch for the exit
+ *    of the launcher.
+ **********************************************************/
+namespace dist {
+
+    const size_t MAILBOX_BYTES = 1 << 20;
+
+    /*
+    * Starts ranks - 1 more copies of this program with the same
+    * arguments and the shared memory segment for all of them.
+    * Has to be called first thing in main, before any thread is
+    * started. Returns the rank of the calling process: 0 in the
+    * launcher, the spawned ranks return theirs without launching.
+    */
+    int launch (int ranks, char *argv[]);
+    // Waits for the spawned ranks in the launcher, returns false if any of them failed
+    bool finish ();
+
+    class Communicator {
+    private:
+        int rank_id = 0;
+        int ranks = 1;
+        void *segment = nullptr;
+        size_t segment_size = 0;
+        uint64_t barrier_generation = 0;
+
+        // Asynchronous all-reduces, run in order by the communication thread
+        std::thread worker;
+        std::mutex lock;
+        std::condition_variable changed;
+        std::deque<std::function<void()>> tasks;
+        bool busy = false;
+        bool stopping = false;
+        double busy_seconds = 0.0; //spent in all-reduces, by any thread
+        double wait_seconds = 0.0; //spent waiting for the asynchronous ones
+        std::string error; //of a failed all-reduce, thrown by the next wait()
+
+        void run ();
+        void send (int to, const void *data, size_t bytes);
+        template <class T>
+        void receive (T *data, long n, bool add);
+        template <class T>
+        void ring (T *data, long n);
+        template <class T>
+        void reduce_buckets (T *data, long n); //runs in the communication thread only
+    public:
+        // Joins the segment of launch(), or makes a single rank without one
+        Communicator ();
+        ~Communicator ();
+        Communicator (const Communicator &) = delete;
+        Communicator& operator = (const Communicator &) = delete;
+
+        int rank () const { return this->rank_id; };
+        int size () const { return this->ranks; };
+        void barrier ();
+        // In place sum of data over all ranks, the same result on every rank, after the queued ones
+        template <class T>
+        void allreduce (T *data, long n);
+        // data *= scale, then the sum over all ranks in the background, data
+        // has to stay untouched until wait(). Ranks have to queue the same sizes in the same order.
+        template <class T>
+        void allreduce_async (T *data, long n, T scale = T(1));
+        void wait (); //until every queued all-reduce is done, throws if one failed
+        double comm_time () const { return this->busy_seconds; }; //seconds of all-reduce so far
+        double wait_time () const { return this->wait_seconds; }; //seconds the caller waited for them
+    };
+}
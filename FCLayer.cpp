@@ -2,29 +2,96 @@
 
 using nn::Parameter;
 
-nn::FCLayer::FCLayer (int n_input, int n_output) {
-    this->W = Parameter(Matrix(n_input, n_output).fill_rand() * 0.001);
-    this->B = Parameter(Matrix(1, n_output).fill_rand() * 0.001);
+template <class T>
+nn::FCLayer<T>::FCLayer (int n_input, int n_output, bool relu) {
+    this->relu = relu;
+    this->W = Parameter<T>(Matrix(n_input, n_output).fill_rand() * 0.001);
+    this->B = Parameter<T>(Matrix(1, n_output).fill_rand() * 0.001);
 }
 
-Matrix nn::FCLayer::forward (Matrix &X) {
-    this->X = X;
-    Matrix result = this->X.dot(this->W.value);
-    
-    return result + this->B.value;
+template <class T>
+nn::FCLayer<T>::FCLayer (int n_input, int n_output, bool relu, T *W, T *B) {
+    this->relu = relu;
+    this->W.value = Matrix::view(W, n_input, n_output);
+    this->B.value = Matrix::view(B, 1, n_output);
 }
 
-Matrix nn::FCLayer::backward (Matrix &d_out) {
-    // W gradient computing
-    Matrix w_grad = this->X.T().dot(d_out);
-    this->W.grad = this->W.grad + w_grad;
+template <class T>
+double nn::FCLayer<T>::sparse_threshold = 0.25;
+
+template <class T>
+BasicMatrix<T> nn::FCLayer<T>::forward (Matrix &X) {
+    // Measure the share of non-zeros of an input out of a ReLU to pick the
+    // dense or the sparse path, any other input is dense
+    this->sparse = false;
+    if (this->sparse_input) {
+        double density = BasicSparseMatrix<T>::density(X);
+        this->density_sum += density;
+        this->density_count++;
+        this->sparse = density < sparse_threshold;
+    }
+
+    Matrix result;
+    if (this->sparse) {
+        this->X_sparse = BasicSparseMatrix<T>(X);
+        result = this->X_sparse.dot(this->W.value);
+        result += this->B.value;
+        if (this->relu) {
+            this->mask = (result > 0);
+            result = this->mask * result;
+        }
+    } else {
+        // Bias, ReLU and its mask are applied in the epilogue of the product
+        this->X = X;
+        result = this->X.dot_bias(this->W.value, this->B.value, this->relu, this->relu ? &this->mask : nullptr);
+    }
+
+    return result;
+}
+
+template <class T>
+BasicMatrix<T> nn::FCLayer<T>::backward (Matrix &d_out) {
+    // Gradient through the fused ReLU
+    Matrix d_relu;
+    if (this->relu)
+        d_relu = d_out * this->mask;
+    Matrix &d = this->relu ? d_relu : d_out;
+    // W gradient computing, accumulated straight into W.grad
+    if (this->sparse)
+        BasicSparseMatrix<T>::spmm(1.0, this->X_sparse, true, d, 1.0, this->W.grad);
+    else
+        Matrix::gemm(1.0, this->X, true, d, false, 1.0, this->W.grad);
     // B gradient computing
-    Matrix b_grad = d_out.sum(0);
-    this->B.grad = this->B.grad + b_grad;
+    this->B.grad += d.sum(0);
     // Layer gradient computing
-    return d_out.dot(this->W.value.T());
+    return d.dot(this->W.value, false, true);
+}
+
+template <class T>
+void nn::FCLayer<T>::infer (const Matrix &X, Matrix &out) const {
+    // Same paths as forward, without keeping the input, the mask or the density
+    if (this->sparse_input && BasicSparseMatrix<T>::density(X) < sparse_threshold) {
+        out = BasicSparseMatrix<T>(X).dot(this->W.value);
+        out += this->B.value;
+        if (this->relu)
+            out = (out > 0) * out;
+    } else {
+        out = X.dot_bias(this->W.value, this->B.value, this->relu);
+    }
+}
+
+template <class T>
+std::pair<Parameter<T>*, Parameter<T>*> nn::FCLayer<T>::get_params () {
+    return std::pair<Parameter<T>*, Parameter<T>*> (&(this->W), &(this->B));
+}
+
+template <class T>
+double nn::FCLayer<T>::density () {
+    double result = this->density_count > 0 ? this->density_sum / this->density_count : 1.0;
+    this->density_sum = 0.0;
+    this->density_count = 0;
+    return result;
 }
 
-std::pair<Parameter*, Parameter*> nn::FCLayer::get_params () {
-    return std::pair<Parameter*, Parameter*> (&(this->W), &(this->B));
-}
\ No newline at end of file
+template class nn::FCLayer<double>;
+template class nn::FCLayer<float>;
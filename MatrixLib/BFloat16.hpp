@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+/***********************************************************
+ * bfloat16 - 16-bit brain floating point storage type: the
+ * upper half of an IEEE float (8 exponent bits, 7 mantissa
+ * bits). It's only meant for storing weights and activations,
+ * all the arithmetic over it is done in float.
+ * --------------------------------------------------------
+ * compute_type<T> names the type the Matrix kernels use for
+ * arithmetic and accumulation over elements of type T.
+ **********************************************************/
+struct bfloat16 {
+    uint16_t bits;
+
+    bfloat16 () = default;
+    // Rounds to nearest even, NaN stays a (quiet) NaN
+    bfloat16 (float value) {
+        uint32_t u;
+        std::memcpy(&u, &value, sizeof(u));
+        if ((u & 0x7fffffff) > 0x7f800000)
+            this->bits = (uint16_t)((u >> 16) | 0x0040);
+        else
+            this->bits = (uint16_t)((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+    }
+    operator float () const {
+        uint32_t u = (uint32_t)this->bits << 16;
+        float value;
+        std::memcpy(&value, &u, sizeof(value));
+        return value;
+    }
+};
+
+template <class T>
+struct compute_type { using type = T; };
+
+template <>
+struct compute_type<bfloat16> { using type = float; };
+
+template <class T>
+using compute_t = typename compute_type<T>::type;
@@ -0,0 +1,363 @@
+#include "Gemm.hpp"
+#include "Workspace.hpp"
+#include "Parallel.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <omp.h>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+    // Blocking parameters. MR x NR is the register tile of the
+    // micro-kernel, KC x NR panel of B is sized for L1, MC x KC
+    // block of A for L2 and KC x NC panel of B for L3. MC x NC_TILE
+    // is the unit of work handed to an OpenMP thread.
+    template <class T> struct Blocking;
+
+    template <> struct Blocking<double> {
+        static const int MR = 6;
+        static const int NR = 8;
+        static const int MC = 120;
+        static const int KC = 256;
+        static const int NC = 2048;
+        static const int NC_TILE = 128;
+    };
+
+    template <> struct Blocking<float> {
+        static const int MR = 6;
+        static const int NR = 16;
+        static const int MC = 120;
+        static const int KC = 256;
+        static const int NC = 4096;
+        static const int NC_TILE = 128;
+    };
+
+    // Packs rows [i0, i0 + mc) and columns [p0, p0 + kc) of op(A)
+    // into MR-row micro-panels: panel r holds element (i, p)
+    // at r * MR * kc + p * MR + i. Rows past mc are zero padded.
+    // Elements are converted to the compute type C on the way.
+    template <class T, class C>
+    void pack_a (bool trans, const T *a, int lda, int i0, int mc, int p0, int kc, C *dst) {
+        const int MR = Blocking<C>::MR;
+        int panels = (mc + MR - 1) / MR;
+
+        exec::parallel_for(panels, exec::COPY, [&](long begin, long end) {
+            for (int r = begin; r < end; r++) {
+                C *panel = dst + (long)r * MR * kc;
+                int rows = std::min(MR, mc - r * MR);
+                for (int p = 0; p < kc; p++) {
+                    for (int i = 0; i < rows; i++) {
+                        int row = i0 + r * MR + i, col = p0 + p;
+                        panel[p * MR + i] = C(trans ? a[(long)col * lda + row] : a[(long)row * lda + col]);
+                    }
+                    for (int i = rows; i < MR; i++)
+                        panel[p * MR + i] = C(0);
+                }
+            }
+        }, (long)MR * kc);
+    }
+
+    // Packs rows [p0, p0 + kc) and columns [j0, j0 + nc) of op(B)
+    // into NR-column micro-panels: panel q holds element (p, j)
+    // at q * NR * kc + p * NR + j. Columns past nc are zero padded.
+    template <class T, class C>
+    void pack_b (bool trans, const T *b, int ldb, int p0, int kc, int j0, int nc, C *dst) {
+        const int NR = Blocking<C>::NR;
+        int panels = (nc + NR - 1) / NR;
+
+        exec::parallel_for(panels, exec::COPY, [&](long begin, long end) {
+            for (int q = begin; q < end; q++) {
+                C *panel = dst + (long)q * NR * kc;
+                int cols = std::min(NR, nc - q * NR);
+                for (int p = 0; p < kc; p++) {
+                    for (int j = 0; j < cols; j++) {
+                        int row = p0 + p, col = j0 + q * NR + j;
+                        panel[p * NR + j] = C(trans ? b[(long)col * ldb + row] : b[(long)row * ldb + col]);
+                    }
+                    for (int j = cols; j < NR; j++)
+                        panel[p * NR + j] = C(0);
+                }
+            }
+        }, (long)NR * kc);
+    }
+
+    // Portable micro-kernel: C[MR x NR] = alpha * A_panel * B_panel + beta * C.
+    // The accumulator is a local array, so the compiler keeps it in
+    // vector registers and vectorizes the NR loop.
+    template <class T>
+    void micro_kernel (int kc, const T *a, const T *b, T alpha, T beta, T *c, int ldc) {
+        const int MR = Blocking<T>::MR;
+        const int NR = Blocking<T>::NR;
+        T acc[MR][NR] = {};
+
+        for (int p = 0; p < kc; p++) {
+            for (int i = 0; i < MR; i++) {
+                #pragma omp simd
+                for (int j = 0; j < NR; j++)
+                    acc[i][j] += a[i] * b[j];
+            }
+            a += MR;
+            b += NR;
+        }
+
+        for (int i = 0; i < MR; i++)
+            for (int j = 0; j < NR; j++)
+                c[i * ldc + j] = (beta == T(0)) ? alpha * acc[i][j] : alpha * acc[i][j] + beta * c[i * ldc + j];
+    }
+
+#if defined(__AVX2__) && defined(__FMA__)
+    // 6 x 8 double micro-kernel: 12 ymm accumulators, 2 ymm for the
+    // B row and 1 broadcast register for A.
+    template <>
+    void micro_kernel<double> (int kc, const double *a, const double *b, double alpha, double beta, double *c, int ldc) {
+        __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+        __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+        __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+        __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+        __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+        __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+
+        for (int p = 0; p < kc; p++) {
+            __m256d b0 = _mm256_loadu_pd(b);
+            __m256d b1 = _mm256_loadu_pd(b + 4);
+            __m256d av;
+
+            av = _mm256_broadcast_sd(a + 0);
+            c00 = _mm256_fmadd_pd(av, b0, c00); c01 = _mm256_fmadd_pd(av, b1, c01);
+            av = _mm256_broadcast_sd(a + 1);
+            c10 = _mm256_fmadd_pd(av, b0, c10); c11 = _mm256_fmadd_pd(av, b1, c11);
+            av = _mm256_broadcast_sd(a + 2);
+            c20 = _mm256_fmadd_pd(av, b0, c20); c21 = _mm256_fmadd_pd(av, b1, c21);
+            av = _mm256_broadcast_sd(a + 3);
+            c30 = _mm256_fmadd_pd(av, b0, c30); c31 = _mm256_fmadd_pd(av, b1, c31);
+            av = _mm256_broadcast_sd(a + 4);
+            c40 = _mm256_fmadd_pd(av, b0, c40); c41 = _mm256_fmadd_pd(av, b1, c41);
+            av = _mm256_broadcast_sd(a + 5);
+            c50 = _mm256_fmadd_pd(av, b0, c50); c51 = _mm256_fmadd_pd(av, b1, c51);
+
+            a += 6;
+            b += 8;
+        }
+
+        __m256d acc[6][2] = { {c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51} };
+        __m256d va = _mm256_set1_pd(alpha);
+        __m256d vb = _mm256_set1_pd(beta);
+        for (int i = 0; i < 6; i++) {
+            double *row = c + i * ldc;
+            __m256d r0 = _mm256_mul_pd(va, acc[i][0]);
+            __m256d r1 = _mm256_mul_pd(va, acc[i][1]);
+            if (beta != 0.0) {
+                r0 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(row), r0);
+                r1 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(row + 4), r1);
+            }
+            _mm256_storeu_pd(row, r0);
+            _mm256_storeu_pd(row + 4, r1);
+        }
+    }
+
+    // 6 x 16 float micro-kernel, same register layout as the double one
+    template <>
+    void micro_kernel<float> (int kc, const float *a, const float *b, float alpha, float beta, float *c, int ldc) {
+        __m256 acc[6][2];
+        for (int i = 0; i < 6; i++)
+            acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+
+        for (int p = 0; p < kc; p++) {
+            __m256 b0 = _mm256_loadu_ps(b);
+            __m256 b1 = _mm256_loadu_ps(b + 8);
+            for (int i = 0; i < 6; i++) {
+                __m256 av = _mm256_broadcast_ss(a + i);
+                acc[i][0] = _mm256_fmadd_ps(av, b0, acc[i][0]);
+                acc[i][1] = _mm256_fmadd_ps(av, b1, acc[i][1]);
+            }
+            a += 6;
+            b += 16;
+        }
+
+        __m256 va = _mm256_set1_ps(alpha);
+        __m256 vb = _mm256_set1_ps(beta);
+        for (int i = 0; i < 6; i++) {
+            float *row = c + i * ldc;
+            __m256 r0 = _mm256_mul_ps(va, acc[i][0]);
+            __m256 r1 = _mm256_mul_ps(va, acc[i][1]);
+            if (beta != 0.0f) {
+                r0 = _mm256_fmadd_ps(vb, _mm256_loadu_ps(row), r0);
+                r1 = _mm256_fmadd_ps(vb, _mm256_loadu_ps(row + 8), r1);
+            }
+            _mm256_storeu_ps(row, r0);
+            _mm256_storeu_ps(row + 8, r1);
+        }
+    }
+#endif
+
+    // Runs the micro-kernel over a tile that may be cut by the matrix
+    // edges. Partial tiles, and outputs stored in another type than
+    // the compute type, go through a scratch tile first.
+    template <class T, class C>
+    void edge_kernel (int mr, int nr, int kc, const C *a, const C *b, C alpha, C beta, T *c, int ldc) {
+        const int MR = Blocking<C>::MR;
+        const int NR = Blocking<C>::NR;
+        if constexpr (std::is_same<T, C>::value) {
+            if (mr == MR && nr == NR) {
+                micro_kernel<C>(kc, a, b, alpha, beta, c, ldc);
+                return;
+            }
+        }
+
+        C tile[MR * NR];
+        micro_kernel<C>(kc, a, b, C(1), C(0), tile, NR);
+        for (int i = 0; i < mr; i++)
+            for (int j = 0; j < nr; j++)
+                c[i * ldc + j] = (beta == C(0)) ? T(alpha * tile[i * NR + j])
+                                                : T(alpha * tile[i * NR + j] + beta * C(c[i * ldc + j]));
+    }
+
+    // Epilogue of rows [0, mr) and columns [0, nr) of a tile, c, bias
+    // and mask point at the tile's first element. Every combination of
+    // the steps is its own branch-free loop. The mask gets a pass of its
+    // own over the cached row, interleaving its stores with the output's
+    // was twice as slow.
+    template <class T, class C, bool BIAS, bool MASK, bool RELU>
+    void epilogue_rows (int mr, int nr, T *c, int ldc, const T *bias, T *mask) {
+        for (int i = 0; i < mr; i++) {
+            T *row = c + (long)i * ldc;
+            T *mask_row = MASK ? mask + (long)i * ldc : nullptr;
+            if constexpr (MASK) {
+                #pragma omp simd
+                for (int j = 0; j < nr; j++) {
+                    C value = C(row[j]);
+                    if constexpr (BIAS)
+                        value = C(T(value + C(bias[j])));
+                    mask_row[j] = T((value > C(0)) ? C(1) : C(0));
+                }
+            }
+            #pragma omp simd
+            for (int j = 0; j < nr; j++) {
+                C value = C(row[j]);
+                if constexpr (BIAS)
+                    value = C(T(value + C(bias[j])));
+                row[j] = RELU ? T(((value > C(0)) ? C(1) : C(0)) * value) : T(value);
+            }
+        }
+    }
+
+    template <class T, class C>
+    void apply_epilogue (int mr, int nr, T *c, int ldc, const T *bias, bool relu, T *mask) {
+        using Kernel = void (*)(int, int, T *, int, const T *, T *);
+        static const Kernel kernels[8] = {
+            epilogue_rows<T, C, false, false, false>, epilogue_rows<T, C, false, false, true>,
+            epilogue_rows<T, C, false, true, false>, epilogue_rows<T, C, false, true, true>,
+            epilogue_rows<T, C, true, false, false>, epilogue_rows<T, C, true, false, true>,
+            epilogue_rows<T, C, true, true, false>, epilogue_rows<T, C, true, true, true>,
+        };
+        kernels[(bias != nullptr) * 4 + (mask != nullptr) * 2 + relu](mr, nr, c, ldc, bias, mask);
+    }
+
+    template <class T, class C>
+    void scale (int m, int n, C beta, T *c, int ldc) {
+        exec::parallel_for(m, exec::ELEMENTWISE, [&](long begin, long end) {
+            for (int i = begin; i < end; i++)
+                for (int j = 0; j < n; j++)
+                    c[(long)i * ldc + j] = (beta == C(0)) ? T(C(0)) : T(beta * C(c[(long)i * ldc + j]));
+        }, n);
+    }
+}
+
+
+template <class T>
+void gemm::gemm (bool trans_a, bool trans_b, int m, int n, int k,
+                 compute_t<T> alpha, const T *a, int lda, const T *b, int ldb,
+                 compute_t<T> beta, T *c, int ldc, const Epilogue<T> &epilogue) {
+    using C = compute_t<T>;
+    const int MR = Blocking<C>::MR;
+    const int NR = Blocking<C>::NR;
+    const int MC = Blocking<C>::MC;
+    const int KC = Blocking<C>::KC;
+    const int NC = Blocking<C>::NC;
+    const int NC_TILE = Blocking<C>::NC_TILE;
+
+    if (m <= 0 || n <= 0)
+        return;
+    bool has_epilogue = epilogue.bias || epilogue.relu || epilogue.mask;
+    if (k <= 0 || alpha == C(0)) {
+        scale<T, C>(m, n, beta, c, ldc);
+        if (has_epilogue) {
+            exec::parallel_for(m, exec::ELEMENTWISE, [&](long begin, long end) {
+                apply_epilogue<T, C>(end - begin, n, c + begin * ldc, ldc, epilogue.bias, epilogue.relu,
+                                     epilogue.mask ? epilogue.mask + begin * ldc : nullptr);
+            }, n);
+        }
+        return;
+    }
+
+    // Packing buffers are reused between calls of the same thread,
+    // the workspace allocator keeps the panels 64-byte aligned
+    static thread_local std::vector<C, workspace::Allocator<C>> a_pack, b_pack;
+    int m_padded = (m + MR - 1) / MR * MR;
+    a_pack.resize((size_t)m_padded * KC);
+    b_pack.resize((size_t)(std::min(n, NC) + NR - 1) / NR * NR * KC);
+    C *a_buf = a_pack.data();
+    C *b_buf = b_pack.data();
+
+    for (int jc = 0; jc < n; jc += NC) {
+        int nc = std::min(NC, n - jc);
+        for (int pc = 0; pc < k; pc += KC) {
+            int kc = std::min(KC, k - pc);
+            // Only the first K-block applies the user's beta, the rest accumulate,
+            // the last one finishes the tiles with the epilogue
+            C beta_k = (pc == 0) ? beta : C(1);
+            bool last_k = has_epilogue && pc + kc >= k;
+
+            pack_b<T, C>(trans_b, b, ldb, pc, kc, jc, nc, b_buf);
+            pack_a<T, C>(trans_a, a, lda, 0, m, pc, kc, a_buf);
+
+            int m_tiles = (m + MC - 1) / MC;
+            int n_tiles = (nc + NC_TILE - 1) / NC_TILE;
+            int tiles = m_tiles * n_tiles;
+
+            auto run_tile = [&](int t) {
+                int ic = t / n_tiles * MC, mc = std::min(MC, m - ic);
+                int jt = t % n_tiles * NC_TILE, nt = std::min(NC_TILE, nc - jt);
+                for (int jr = 0; jr < nt; jr += NR) {
+                    int nr = std::min(NR, nt - jr);
+                    const C *b_panel = b_buf + (long)(jt + jr) / NR * NR * kc;
+                    for (int ir = 0; ir < mc; ir += MR) {
+                        int mr = std::min(MR, mc - ir);
+                        const C *a_panel = a_buf + (long)(ic + ir) / MR * MR * kc;
+                        T *c_tile = c + (long)(ic + ir) * ldc + jc + jt + jr;
+                        edge_kernel<T, C>(mr, nr, kc, a_panel, b_panel, alpha, beta_k, c_tile, ldc);
+                    }
+                }
+                // The whole tile is still in L2
+                if (last_k) {
+                    long offset = (long)ic * ldc + jc + jt;
+                    apply_epilogue<T, C>(mc, nt, c + offset, ldc, epilogue.bias ? epilogue.bias + jc + jt : nullptr,
+                                         epilogue.relu, epilogue.mask ? epilogue.mask + offset : nullptr);
+                }
+            };
+
+            // Tiles are uneven at the edges, so they are handed out dynamically
+            int count = std::min(exec::threads(2L * m * nc * kc, exec::GEMM), tiles);
+            if (count > 1) {
+                #pragma omp parallel for schedule(dynamic) num_threads(count)
+                for (int t = 0; t < tiles; t++)
+                    run_tile(t);
+            } else {
+                for (int t = 0; t < tiles; t++)
+                    run_tile(t);
+            }
+        }
+    }
+}
+
+template void gemm::gemm<double> (bool, bool, int, int, int, double, const double *, int,
+                                  const double *, int, double, double *, int, const Epilogue<double> &);
+template void gemm::gemm<float> (bool, bool, int, int, int, float, const float *, int,
+                                 const float *, int, float, float *, int, const Epilogue<float> &);
+template void gemm::gemm<bfloat16> (bool, bool, int, int, int, float, const bfloat16 *, int,
+                                    const bfloat16 *, int, float, bfloat16 *, int, const Epilogue<bfloat16> &);
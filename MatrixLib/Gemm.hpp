@@ -0,0 +1,57 @@
+#pragma once
+#include "BFloat16.hpp"
+
+/***********************************************************
+ * gemm - general matrix-matrix multiplication engine that
+ * backs Matrix::dot. Computes
+ *      C = alpha * op(A) * op(B) + beta * C
+ * over row-major buffers, where op(X) is X or X^T.
+ * --------------------------------------------------------
+ * The implementation follows the classic Goto/BLIS scheme:
+ *    -B is packed into KC x NC panels (kept in L3),
+ *    -A is packed into MC x KC blocks (kept in L2),
+ *    -a register-blocked MR x NR micro-kernel streams the
+ *    packed panels from L1 and accumulates in registers.
+ * OpenMP threads split the output into MC x NC_TILE tiles.
+ * Transposed operands are handled by the packing routines,
+ * so no transposed copy is ever materialized. bfloat16
+ * operands are widened to float while packing, so products
+ * are accumulated in float.
+ * --------------------------------------------------------
+ * An optional epilogue (bias, ReLU, ReLU mask) is applied to
+ * every output tile right after its last K block, while the
+ * tile is still in cache, instead of separate passes over C.
+ **********************************************************/
+namespace gemm {
+
+    /*
+    * Post-processing of C, rounded exactly like the unfused
+    *      C += bias; mask = (C > 0); C = mask * C
+    * of Matrix, so both give bit-identical results.
+    *   const T *bias - n values added to every row, or nullptr
+    *   bool relu - apply ReLU after the bias
+    *   T *mask - m x n output with leading dimension ldc, gets
+    *             1 where the biased C is > 0 and 0 elsewhere,
+    *             or nullptr
+    */
+    template <class T>
+    struct Epilogue {
+        const T *bias = nullptr;
+        bool relu = false;
+        T *mask = nullptr;
+    };
+
+    /*
+    * Parameters:
+    *   bool trans_a, trans_b - use A^T / B^T instead of A / B
+    *   int m, n, k - op(A) is m x k, op(B) is k x n, C is m x n
+    *   alpha, beta - scaling factors, C is not read if beta == 0
+    *   const T *a, *b - operands with leading dimensions lda, ldb
+    *   T *c - output with leading dimension ldc
+    *   const Epilogue<T> &epilogue - applied to C at the end
+    */
+    template <class T>
+    void gemm (bool trans_a, bool trans_b, int m, int n, int k,
+               compute_t<T> alpha, const T *a, int lda, const T *b, int ldb,
+               compute_t<T> beta, T *c, int ldc, const Epilogue<T> &epilogue = Epilogue<T>());
+}
@@ -1,186 +1,179 @@
 #include "Matrix.hpp"
+#include "Gemm.hpp"
+#include "VecMath.hpp"
+#include "Parallel.hpp"
+#include "Random.hpp"
+#include "Reduce.hpp"
 
 #include <iostream>
-#include <random>
 #include <vector>
 #include <tuple>
 #include <math.h>
 #include <omp.h>
 
 
-Matrix::Matrix (int rows, int cols) {
+template <class DType>
+BasicMatrix<DType>::BasicMatrix (int rows, int cols) {
     this->row_size = rows;
     this->col_size = cols;
     this->matrix.resize(this->row_size * this->col_size);
 };
 
-Matrix::Matrix (vector<vector<double>> data) {
+template <class DType>
+BasicMatrix<DType>::BasicMatrix (vector<vector<DType>> data) {
     this->row_size = data.size();
     this->col_size = data[0].size();
-    for (auto it_1 : data){
-        for (auto it_2 : it_1)
-            this->matrix.push_back(it_2);
-    }
+    this->matrix.resize((size_t)this->row_size * this->col_size);
+    for (int i = 0; i < this->row_size; i++)
+        std::copy(data[i].begin(), data[i].end(), this->matrix.data() + (size_t)i * this->col_size);
 };
 
-Matrix& Matrix::fill_ones () {
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        this->matrix[i] = 1;
-    }
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::view (DType *data, int rows, int cols) {
+    BasicMatrix result(0, 0);
+    result.row_size = rows;
+    result.col_size = cols;
+    result.matrix = workspace::Buffer<DType>::view(data, (size_t)rows * cols);
+    return result;
+}
+
+template <class DType>
+BasicMatrix<DType>& BasicMatrix<DType>::fill_ones () {
+    DType *data = this->matrix.data();
+    exec::parallel_for((long)this->matrix.size(), exec::ELEMENTWISE, [&](long begin, long end) {
+        std::fill(data + begin, data + end, DType(1));
+    });
     return (*this);
 }
 
-Matrix& Matrix::fill_zeros () {
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        this->matrix[i] = 0;
-    }
+template <class DType>
+BasicMatrix<DType>& BasicMatrix<DType>::fill_zeros () {
+    DType *data = this->matrix.data();
+    exec::parallel_for((long)this->matrix.size(), exec::ELEMENTWISE, [&](long begin, long end) {
+        std::fill(data + begin, data + end, DType(0));
+    });
     return (*this);
 }
 
-Matrix& Matrix::fill_rand () {
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++){
-        std::random_device rd{};
-        std::mt19937 gen{rd()};
-        std::normal_distribution<> d(0, 1);
+template <class DType>
+BasicMatrix<DType>& BasicMatrix<DType>::fill_rand () {
+    return this->fill_rand(rng::seed(), rng::next_stream());
+}
 
-        this->matrix[i] = d(gen);
-    }
+template <class DType>
+BasicMatrix<DType>& BasicMatrix<DType>::fill_rand (uint64_t seed, uint64_t stream) {
+    rng::normal(this->matrix.data(), (long)this->matrix.size(), seed, stream);
     return (*this);
 }
 
-Matrix Matrix::dot (const Matrix &mtx) {
+// Matrix product op(this) x op(mtx), where op() transposes
+// its argument if the corresponding flag is set.
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::dot (const BasicMatrix &mtx, bool trans_this, bool trans_mtx) const {
+    int rows = trans_this ? this->col_size : this->row_size;
+    int cols = trans_mtx ? mtx.row_size : mtx.col_size;
+    BasicMatrix dotProduct(rows, cols);
+
+    BasicMatrix::gemm(compute_type(1), (*this), trans_this, mtx, trans_mtx, compute_type(0), dotProduct);
+    return dotProduct;
+};
+
+// this x mtx + bias, bias being a row broadcast over the rows of the
+// product, with an optional ReLU. The bias, the ReLU and the ReLU mask
+// (result > 0, if mask isn't null) are computed in the epilogue of the
+// product, bit-identical to dot(), += bias, > 0 and * mask.
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::dot_bias (const BasicMatrix &mtx, const BasicMatrix &bias, bool relu, BasicMatrix *mask) const {
     if (this->col_size != mtx.row_size) {
         throw std::runtime_error("Matrices aren't compatible!");
     }
-    Matrix mtx_transposed = mtx.T();
-    Matrix dotProduct(this->row_size, mtx.col_size);
+    if (bias.row_size != 1 || bias.col_size != mtx.col_size) {
+        throw std::runtime_error("Bias has incompatible shape!");
+    }
+    BasicMatrix result(this->row_size, mtx.col_size);
+    if (mask && mask->shape() != result.shape())
+        (*mask) = BasicMatrix(result.shape());
+
+    ::gemm::Epilogue<DType> epilogue;
+    epilogue.bias = bias.matrix.data();
+    epilogue.relu = relu;
+    epilogue.mask = mask ? mask->matrix.data() : nullptr;
+    ::gemm::gemm<DType>(false, false, this->row_size, mtx.col_size, this->col_size,
+                        compute_type(1), this->matrix.data(), this->col_size, mtx.matrix.data(), mtx.col_size,
+                        compute_type(0), result.matrix.data(), result.col_size, epilogue);
+    return result;
+}
 
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size; i++) {
-        int i_offset = i * this->col_size;
-        for (int j = 0; j < mtx.col_size; j++) {
-            int j_offset = j * mtx_transposed.col_size;
-            double product_sum = 0.0;
-            for (int k = 0; k < this->col_size; k++){
-                dotProduct.matrix[i * dotProduct.col_size + j] += this->matrix[i_offset + k] * mtx_transposed.matrix[j_offset + k];
-            }
-        }
+// BLAS-like C = alpha * op(A) x op(B) + beta * C. With beta == 0
+// C is resized to the product shape if needed and never read.
+template <class DType>
+void BasicMatrix<DType>::gemm (compute_type alpha, const BasicMatrix &A, bool trans_a, const BasicMatrix &B, bool trans_b, compute_type beta, BasicMatrix &C) {
+    int m = trans_a ? A.col_size : A.row_size;
+    int k = trans_a ? A.row_size : A.col_size;
+    int k_b = trans_b ? B.col_size : B.row_size;
+    int n = trans_b ? B.row_size : B.col_size;
+
+    if (k != k_b) {
+        throw std::runtime_error("Matrices aren't compatible!");
     }
-    return dotProduct;
+    if (C.row_size != m || C.col_size != n) {
+        if (beta != compute_type(0))
+            throw std::runtime_error("Output matrix has incompatible shape!");
+        C = BasicMatrix(m, n);
+    }
+
+    ::gemm::gemm<DType>(trans_a, trans_b, m, n, k,
+                        alpha, A.matrix.data(), A.col_size, B.matrix.data(), B.col_size,
+                        beta, C.matrix.data(), C.col_size);
 };
 
-Matrix Matrix::T () const {
-    Matrix Transposed(this->col_size, this->row_size);
-    #pragma omp parallel for
-    for (int i = 0; i < this->col_size; i++) {
-        int i_offset = i * this->row_size;
-        for (int j = 0; j < this->row_size; j++) {
-            Transposed.matrix[i_offset + j] = this->matrix[j * this->col_size + i];
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::T () const {
+    BasicMatrix Transposed(this->col_size, this->row_size);
+    exec::parallel_for(this->col_size, exec::COPY, [&](long begin, long end) {
+        for (int i = begin; i < end; i++) {
+            int i_offset = i * this->row_size;
+            for (int j = 0; j < this->row_size; j++) {
+                Transposed.matrix[i_offset + j] = this->matrix[j * this->col_size + i];
+            }
         }
-    }
+    }, this->row_size);
 
     return Transposed;
 };
 
-Matrix Matrix::sum (const int &axis) {
-    Matrix Sum;
-
-    if (axis == 0) {
-        Sum = Matrix(1 , this->col_size);
-        #pragma omp parallel for
-        for (int j = 0; j < this->col_size; j++) {
-            double col_sum = 0.0;
-            for (int i = 0; i < this->row_size; i++) {
-                Sum.matrix[j] += this->matrix[i * this->col_size + j];
-            }
-        }
-    }
-    else if (axis == 1) {
-        Sum = Matrix(this->row_size, 1);
-        #pragma omp parallel for
-        for (int i = 0; i < this->row_size; i++) {
-            int i_offset = i * this->col_size;
-            double row_sum = 0.0;
-            #pragma omp parallel for reduction(+: row_sum)
-            for (int j = 0; j < this->col_size; j++) {
-                Sum.matrix[i] += this->matrix[i_offset + j];
-            }
-        }
-    }
-    else  {
+// One value per column (axis 0) or per row (axis 1), see Reduce.hpp
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::reduce_axis (reduce::Op op, const int &axis) const {
+    if (axis != 0 && axis != 1)
         throw std::runtime_error("Error: There is no " + std::to_string(axis) + " axis!\n");
-    }
-    
-    return Sum;
+    BasicMatrix result = (axis == 0) ? BasicMatrix(1, this->col_size) : BasicMatrix(this->row_size, 1);
+    reduce::reduce(op, axis, this->matrix.data(), this->row_size, this->col_size, result.matrix.data());
+    return result;
 };
 
-Matrix Matrix::argmax (const int &axis) {
-    Matrix argmaxMx;
-    Matrix maxMx = (*this).max(axis);
-    if (axis == 0) {
-        argmaxMx = Matrix(1 , this->col_size);
-        #pragma omp parallel for
-        for (int j = 0; j < this->col_size; j++){
-            for (int i = 0; i < this->row_size; i++){
-                if (this->matrix[i * this->col_size + j] == maxMx.matrix[j])
-                    argmaxMx.matrix[j] = i;
-            }
-        }
-    }
-    else if (axis == 1) {
-        argmaxMx= Matrix(this->row_size, 1);
-        #pragma omp prarallel for
-        for (int i = 0; i < this->row_size; i++){
-            int i_offset = i * this->col_size;
-            for (int j = 0; j < this->col_size; j++){
-                if (this->matrix[i_offset + j] == maxMx.matrix[i])
-                    argmaxMx.matrix[i] = j;
-            }
-        }
-    }
-    else {
-        throw std::runtime_error("Error: There is no " + std::to_string(axis) + " axis!\n");
-    }
-    return argmaxMx;
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::sum (const int &axis) const {
+    return this->reduce_axis(reduce::SUM, axis);
 };
 
-Matrix Matrix::max (const int &axis) {
-    Matrix maxMx;
-    if (axis == 0) {
-        maxMx = Matrix(1 , this->col_size);
-        #pragma omp parallel for
-        for (int j = 0; j < this->col_size; j++){
-            for (int i = 0; i < this->row_size; i++){
-                if (this->matrix[i * this->col_size + j] > maxMx.matrix[j])
-                    maxMx.matrix[j] = this->matrix[i * this->col_size + j];
-            }
-        }
-    }
-    else if (axis == 1) {
-        maxMx= Matrix(this->row_size, 1);
-        #pragma omp parallel for
-        for (int i = 0; i < this->row_size; i++){
-            int i_offset = i * this->col_size;
-            for (int j = 0; j < this->col_size; j++){
-                if (this->matrix[i_offset + j] > maxMx.matrix[i])
-                    maxMx.matrix[i] = this->matrix[i_offset + j];
-            }
-        }
-    }
-    else {
-        throw std::runtime_error("Error: There is no " + std::to_string(axis) + " axis!\n");
-    }
-    return maxMx;
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::argmax (const int &axis) const {
+    return this->reduce_axis(reduce::ARGMAX, axis);
+};
+
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::max (const int &axis) const {
+    return this->reduce_axis(reduce::MAX, axis);
 };
 
-tuple<int, int> Matrix::shape () {
+template <class DType>
+tuple<int, int> BasicMatrix<DType>::shape () const {
     return std::tuple<int, int>(this->row_size, this->col_size);
 };
 
-Matrix Matrix::reshape (int rows, int cols) {
+template <class DType>
+void BasicMatrix<DType>::check_reshape (int &rows, int &cols) const {
     int size = (this->row_size) * (this->col_size);
     if (rows == -1) {
         rows = size / cols;
@@ -190,292 +183,170 @@ Matrix Matrix::reshape (int rows, int cols) {
     if ( (cols * rows) != size) {
         throw std::runtime_error("Cannot reshape, arrays have incompatible size!");
     }
+};
 
-    Matrix reshapedMx = (*this);
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::reshape (int rows, int cols) const & {
+    return BasicMatrix(*this).reshape(rows, cols);
+};
 
-    reshapedMx.row_size = rows;
-    reshapedMx.col_size = cols;
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::reshape (int rows, int cols) && {
+    this->check_reshape(rows, cols);
+    this->row_size = rows;
+    this->col_size = cols;
 
-    return reshapedMx;
+    return std::move(*this);
 };
 
-double Matrix::ndim() {
+template <class DType>
+double BasicMatrix<DType>::ndim() const {
     if (this->row_size != 0 && this->col_size != 0)
         return (this->row_size == 1) || (this->col_size == 1) ? 1.0 : 2.0;
     else
         return 0.0;
 };
 
-Matrix Matrix::mean (const int &axis) {
-    Matrix meanMx;
-    if (axis == 0) {
-        meanMx = Matrix(1 , this->col_size);
-        #pragma omp parallel for
-        for (int j = 0; j < this->col_size; j++){
-            double col_sum = 0.0;
-            #pragma omp parallel for reduction(+: col_sum)
-            for (int i = 0; i < this->row_size; i++){
-                col_sum += this->matrix[i * this->col_size + j];
-            }
-            meanMx.matrix[j] = col_sum;
-        }
-        #pragma omp parallel for
-        for (int j = 0; j < meanMx.col_size; j++)
-            meanMx.matrix[j] = meanMx.matrix[j] / this->row_size;
-
-    }
-    else if (axis == 1) {
-        meanMx= Matrix(this->row_size, 1);
-        #pragma omp parallel for
-        for (int i = 0; i < this->row_size; i++){
-            int i_offset = i * this->col_size;
-            double row_sum = 0.0;
-            #pragma omp parallel for reduction(+: row_sum)
-            for (int j = 0; j < this->col_size; j++){
-                row_sum += this->matrix[i_offset + j];
-            }
-            meanMx.matrix[i] = row_sum;
-        }
-        #pragma omp parallel for
-        for (int i = 0; i < meanMx.col_size; i++)
-            meanMx.matrix[i] = meanMx.matrix[i] / this->col_size;
-    }
-    else {
-        throw std::runtime_error("Error: There is no " + std::to_string(axis) + " axis!\n");
-    }
-    return meanMx;
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::mean (const int &axis) const {
+    return this->reduce_axis(reduce::MEAN, axis);
 };
 
-Matrix Matrix::log () {
-    Matrix LogMx(this->row_size, this->col_size);
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        LogMx.matrix[i] = std::log(this->matrix[i]);
-    }
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::log () const & {
+    BasicMatrix LogMx(this->row_size, this->col_size);
+    vmath::log(this->matrix.data(), LogMx.matrix.data(), (long)this->matrix.size());
     return LogMx;
 };
 
-Matrix Matrix::exp() {
-    Matrix ExpMx(this->shape());
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        ExpMx.matrix[i] =  std::exp(this->matrix[i]);
-    }
-    return ExpMx;
-};
-
-Matrix Matrix::sqrt() {
-    Matrix SqrtMx(this->row_size, this->col_size);
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        SqrtMx.matrix[i] = std::sqrt(this->matrix[i]);
-    }
-    return SqrtMx;
-}
-
-Matrix Matrix::broadcast (tuple<int, int> shape) {
-    int cols = this->col_size;
-    int rows = this->row_size;
-    int desire_c = std::get<1>(shape);
-    int desire_r = std::get<0>(shape);
-    Matrix BroadcastMx = (*this);
-
-    if (cols == 1){
-        BroadcastMx.col_size = desire_c;
-        BroadcastMx.matrix.resize(BroadcastMx.row_size * BroadcastMx.col_size);
-        #pragma omp parallel for
-        for (int i = 0; i < rows; i++)
-            for (int j = 0; j < desire_c; j++){
-                BroadcastMx.matrix[i * BroadcastMx.col_size + j] = this->matrix[i];
-            }
-    }
-    else if (cols != desire_c) {
-        throw std::runtime_error("Error: Matrix (" + std::to_string(rows) + ", " + std::to_string(cols) +
-            ") cannot be broadcasted to shape (" + std::to_string(desire_r) + ", " + std::to_string(desire_c) + ")!\n");
-    }
-
-    if (rows == 1){
-        BroadcastMx.row_size = desire_r;
-        BroadcastMx.matrix.resize(BroadcastMx.row_size * BroadcastMx.col_size);
-        #pragma omp parallel for
-        for (int i = 0; i < desire_r; i++)
-            for (int j = 0; j < BroadcastMx.col_size; j++){
-                BroadcastMx.matrix[i * BroadcastMx.col_size + j] = BroadcastMx.matrix[j];
-            }
-    }
-    else if (rows != desire_r) {
-        throw std::runtime_error("Error: Matrix (" + std::to_string(rows) + ", " + std::to_string(cols) +
-            ") cannot be broadcasted to shape (" + std::to_string(desire_r) + ", " + std::to_string(desire_c) + ")!\n");
-    }
-
-    return BroadcastMx;
+// Temporaries are transformed in place, their buffer is reused
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::log () && {
+    vmath::log(this->matrix.data(), this->matrix.data(), (long)this->matrix.size());
+    return std::move(*this);
 };
 
-tuple<int, int> Matrix::broadcast_shape (tuple<int, int> l_shape, tuple<int, int> r_shape) {
-    int rows = std::max(std::get<0>(l_shape), std::get<0>(r_shape));
-    int cols = std::max(std::get<1>(l_shape), std::get<1>(r_shape));
-
-    return std::tuple<int, int>(rows, cols);
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::exp () const & {
+    BasicMatrix ExpMx(this->shape());
+    vmath::exp(this->matrix.data(), ExpMx.matrix.data(), (long)this->matrix.size());
+    return ExpMx;
 };
 
-Matrix Matrix::operator + (Matrix &mtx) {
-    auto shape = broadcast_shape((*this).shape(), mtx.shape());
-    Matrix l = (*this).broadcast(shape);
-    Matrix r = mtx.broadcast(shape);
-    Matrix AddMx(std::get<0>(shape), std::get<1>(shape));
-
-    #pragma omp parallel for
-    for (int i = 0; i < l.row_size * l.col_size; i++)
-        AddMx.matrix[i] = l.matrix[i] + r.matrix[i];
-
-    return AddMx;
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::exp () && {
+    vmath::exp(this->matrix.data(), this->matrix.data(), (long)this->matrix.size());
+    return std::move(*this);
 };
 
-Matrix Matrix::operator - (Matrix & mtx) {
-    auto shape = broadcast_shape((*this).shape(), mtx.shape());
-    Matrix l = (*this).broadcast(shape);
-    Matrix r = mtx.broadcast(shape);
-    Matrix SubMx(std::get<0>(shape), std::get<1>(shape));
-    
-    #pragma omp parallel for
-    for (int i = 0; i < l.row_size * l.col_size; i++)
-        SubMx.matrix[i] = l.matrix[i] - r.matrix[i];
-
-    return SubMx;
-};
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::sqrt () const & {
+    BasicMatrix SqrtMx(this->row_size, this->col_size);
+    vmath::sqrt(this->matrix.data(), SqrtMx.matrix.data(), (long)this->matrix.size());
+    return SqrtMx;
+}
 
-Matrix Matrix::operator * (Matrix mtx) {
-    auto shape = broadcast_shape((*this).shape(), mtx.shape());
-    Matrix l = (*this).broadcast(shape);
-    Matrix r = mtx.broadcast(shape);
-    Matrix MultyMx(std::get<0>(shape), std::get<1>(shape));
-    #pragma omp parallel for
-    for (int i = 0; i < l.row_size * l.col_size; i++){
-        MultyMx.matrix[i] = l.matrix[i] * r.matrix[i];
-    }
-    
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::sqrt () && {
+    vmath::sqrt(this->matrix.data(), this->matrix.data(), (long)this->matrix.size());
+    return std::move(*this);
+}
 
-    return MultyMx;
+// Broadcasting doesn't replicate anything, it returns a view
+// that reads the same row or column with zero stride.
+template <class DType>
+matrix_expr::Terminal<DType> BasicMatrix<DType>::broadcast (tuple<int, int> shape) const & {
+    return matrix_expr::Terminal<DType>(*this).broadcast(std::get<0>(shape), std::get<1>(shape));
 };
 
-Matrix Matrix::operator * (double val) {
-    Matrix MultyMx(this->shape());
-    
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        MultyMx.matrix[i] = this->matrix[i] * val;
-    }
-    return MultyMx;
+template <class DType>
+matrix_expr::Terminal<DType> BasicMatrix<DType>::broadcast (tuple<int, int> shape) && {
+    return matrix_expr::Terminal<DType>(std::move(*this)).broadcast(std::get<0>(shape), std::get<1>(shape));
 };
 
-Matrix Matrix::operator + (double val) {
-    Matrix AddMx(this->shape());
-    
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        AddMx.matrix[i] = this->matrix[i] + val;
-    }
-    return AddMx;
-};
+// A range of rows is a view too, it only offsets the data pointer.
+template <class DType>
+matrix_expr::Terminal<DType> BasicMatrix<DType>::row_range (int first, int last) const & {
+    return matrix_expr::Terminal<DType>(*this).slice_rows(first, last);
+}
 
-Matrix Matrix::operator - (double val) {
-    Matrix DiffMx(this->shape());
-    
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        DiffMx.matrix[i] = this->matrix[i] - val;
-    }
-    return DiffMx;
-};
+template <class DType>
+matrix_expr::Terminal<DType> BasicMatrix<DType>::row_range (int first, int last) && {
+    return matrix_expr::Terminal<DType>(std::move(*this)).slice_rows(first, last);
+}
 
-Matrix Matrix::operator - () {
-    Matrix MinusMx(this->shape());
+template <class DType>
+tuple<int, int> BasicMatrix<DType>::broadcast_shape (tuple<int, int> l_shape, tuple<int, int> r_shape) {
+    int rows = std::max(std::get<0>(l_shape), std::get<0>(r_shape));
+    int cols = std::max(std::get<1>(l_shape), std::get<1>(r_shape));
 
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        MinusMx.matrix[i] = - this->matrix[i];
-    }
-    return MinusMx;
+    return std::tuple<int, int>(rows, cols);
 };
 
-Matrix Matrix::operator / (Matrix &&mtx) {
-    auto shape = broadcast_shape((*this).shape(), mtx.shape());
-    Matrix l = (*this).broadcast(shape);
-    Matrix r = std::forward<Matrix>(mtx.broadcast(shape));
-    Matrix DivMx(shape);
-
-    #pragma omp parallel for
-    for (int i = 0; i < l.row_size * l.col_size; i++){
-        DivMx.matrix[i] = l.matrix[i] / r.matrix[i];
-    }
-    
-    return DivMx;
-}
-
-Matrix Matrix::operator / (const double &val) {
-    Matrix DivMx(this->shape());
-    
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        DivMx.matrix[i] = this->matrix[i] / val;
-    }
-    return DivMx;
-}
-
-Matrix Matrix::operator ^ (const double &deg) {
-    Matrix PowMx;
-    PowMx = (*this);
-    
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++){
-        PowMx.matrix[i] = std::pow(PowMx.matrix[i], deg);
-    }
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::operator ^ (const double &deg) const & {
+    BasicMatrix PowMx(this->shape());
+    vmath::pow(this->matrix.data(), PowMx.matrix.data(), (long)this->matrix.size(), deg);
     return PowMx;
 };
 
-Matrix& Matrix::operator = (const Matrix & mtx) {
-    this->row_size = mtx.row_size;
-    this->col_size = mtx.col_size;
-    this->matrix = mtx.matrix;
-    return (*this);
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::operator ^ (const double &deg) && {
+    vmath::pow(this->matrix.data(), this->matrix.data(), (long)this->matrix.size(), deg);
+    return std::move(*this);
 };
 
-Matrix& Matrix::operator = (const double & val) {
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-        this->matrix[i] = val;
-    }
+template <class DType>
+BasicMatrix<DType>& BasicMatrix<DType>::operator = (const compute_type & val) {
+    DType *data = this->matrix.data();
+    exec::parallel_for((long)this->matrix.size(), exec::ELEMENTWISE, [&](long begin, long end) {
+        std::fill(data + begin, data + end, DType(val));
+    });
     return (*this);
 };
 
-bool Matrix::operator == (const Matrix & mtx) {
+template <class DType>
+bool BasicMatrix<DType>::operator == (const BasicMatrix & mtx) const {
     if (this->row_size != mtx.row_size || this->col_size != mtx.col_size) {
         return false;
     }else {
-        bool result = true;
-        #pragma omp parallel for reduction(&: result)
-        for (int i = 0; i < this->row_size * this->col_size; i++) {
-            if ( this->matrix[i] != mtx.matrix[i])
-                result = false;
-        }
-        return result;
+        return exec::parallel_reduce((long)this->matrix.size(), exec::ELEMENTWISE, true, [&](long begin, long end) {
+            bool result = true;
+            for (long i = begin; i < end; i++) {
+                if ( this->matrix[i] != mtx.matrix[i])
+                    result = false;
+            }
+            return result;
+        }, [](bool a, bool b) { return a && b; });
     }
 };
 
-Matrix Matrix::operator > (double val) {
-    Matrix GtMx(this->shape());
+template <class DType>
+BasicMatrix<DType> BasicMatrix<DType>::operator > (double val) const {
+    BasicMatrix GtMx(this->shape());
     
-    #pragma omp parallel for
-    for (int i = 0; i < this->row_size * this->col_size; i++) {
-            if (this->matrix[i] > val)
+    exec::parallel_for((long)this->matrix.size(), exec::ELEMENTWISE, [&](long begin, long end) {
+        for (long i = begin; i < end; i++) {
+            if (compute_type(this->matrix[i]) > val)
                 GtMx.matrix[i] = 1;
             else
                 GtMx.matrix[i] = 0;
-    }
+        }
+    });
     return GtMx;
 }
 
-double& Matrix::operator () (const int &row, const int &col) {
+template <class DType>
+DType& BasicMatrix<DType>::operator () (const int &row, const int &col) {
+    if (row > this->row_size - 1 || col > this->col_size - 1)
+        throw std::runtime_error("Requested index is out of matrix's bounds");
+    else {
+        return this->matrix[row * this->col_size + col];
+    }
+};
+
+template <class DType>
+DType BasicMatrix<DType>::operator () (const int &row, const int &col) const {
     if (row > this->row_size - 1 || col > this->col_size - 1)
         throw std::runtime_error("Requested index is out of matrix's bounds");
     else {
@@ -485,13 +356,14 @@ double& Matrix::operator () (const int &row, const int &col) {
 
 //Pretty print function that outstreams 2-dim matrices
 //directly to std::ofstream.
-void Matrix::print (bool np_insert) {
+template <class DType>
+void BasicMatrix<DType>::print (bool np_insert) const {
     std::cout << "[";
     for (int i = 0; i < this->row_size; i++) {
         (i == 0) ? std::cout << "" : std::cout << " ";
         std::cout << " [";
         for (int j = 0; j < this->col_size; j++) {
-            std::cout << " " << this->matrix[i * this->col_size + j];
+            std::cout << " " << compute_type(this->matrix[i * this->col_size + j]);
             if (j < this->col_size - 1 && np_insert){
                 std::cout << ",";
             }
@@ -503,4 +375,8 @@ void Matrix::print (bool np_insert) {
         (i != this->row_size - 1) ? std::cout << "\n" : std::cout << "";
     }
     std::cout << " ]\n";
-};
\ No newline at end of file
+};
+
+template class BasicMatrix<double>;
+template class BasicMatrix<float>;
+template class BasicMatrix<bfloat16>;
@@ -1,16 +1,32 @@
 #pragma once
 #include <vector>
 #include <tuple>
+#include <cstdint>
+#include "BFloat16.hpp"
+#include "Workspace.hpp"
+#include "Reduce.hpp"
 
 using std::vector;
 using std::tuple;
 
+template <class DType> class BasicMatrix;
+
+namespace matrix_expr {
+    template <class E> class Expr;
+    template <class DType> class Terminal;
+}
+
 /***********************************************************
- * Class Matrix is a class that holds the values inside it
+ * Class BasicMatrix is a class that holds the values inside it
  * in a form of 2-dim array. It was developed to provide
  * a better experience while working with matrixes in terms
  * of NN's or ML. Most of it's functionality was inherited
  * on a conceptual level from the NumPy package.
+ * The element type DType is double, float or bfloat16 (storage
+ * only, arithmetic is done in compute_t<DType>, i.e. float).
+ * Matrix is the double precision one. Storage comes from the
+ * per-thread block pool of Workspace.hpp, a view() works on
+ * memory owned elsewhere (e.g. the packed parameters of a Model).
  * --------------------------------------------------------
  * Known issues:
  *    -Unfortunately, at the moment it only supports working
@@ -20,52 +36,97 @@ using std::tuple;
  *    -All functions are experiencing lack of key arguments.
  *    -Getting a value by it's index should be done by using
  *    the round brackets instead of a squared ones.
+ *    -Operators + - * / are lazy (see MatrixExpr.hpp), their
+ *    result has to be assigned to a Matrix or eval()'ed
+ *    before calling Matrix methods on it.
  * --------------------------------------------------------
  * Last changes 17 may 2020 by Skyme Factor.
  **********************************************************/
-class Matrix {
+template <class DType>
+class BasicMatrix {
 private :
     int row_size; //rows i.e. 1-axis
     int col_size; //columns i.e. 0-axis
-    vector<double> matrix; //matrix itself
+    workspace::Buffer<DType> matrix; //matrix itself, in 64-byte aligned pooled memory or a view
+    template <class E>
+    void assign (const E &); //fused evaluation of an expression
+    template <class Op, class R>
+    BasicMatrix& update (R &&); //fused in-place evaluation of this = this Op r
+    void check_reshape (int &, int &) const;
+    BasicMatrix reduce_axis (reduce::Op, const int &) const; //sum, mean, max, argmax along an axis
+
+    template <class U> friend class BasicMatrix;
 
 public:
-    Matrix() : Matrix(1, 1) {};
-    Matrix(int, int);
-    Matrix(vector<vector<double>>);
-    Matrix (std::tuple<int, int> shape) 
-        : Matrix(std::get<0>(shape), std::get<1>(shape)) {};
-    Matrix& fill_zeros();
-    Matrix& fill_ones();
-    Matrix& fill_rand();
-    Matrix dot (const Matrix &);
-    Matrix T () const;
-    Matrix sum (const int &);
-    Matrix argmax (const int &);
-    Matrix max (const int &);
-    tuple<int, int> shape ();
-    Matrix reshape (int, int);
-    double ndim ();
-    Matrix mean (const int &);
-    Matrix log ();
-    Matrix exp ();
-    Matrix sqrt();
-    Matrix broadcast (tuple<int, int>);
+    using value_type = DType;
+    using compute_type = compute_t<DType>; //type of arithmetic and accumulators
+    BasicMatrix() : BasicMatrix(1, 1) {};
+    BasicMatrix(int, int);
+    BasicMatrix(vector<vector<DType>>);
+    BasicMatrix (std::tuple<int, int> shape) 
+        : BasicMatrix(std::get<0>(shape), std::get<1>(shape)) {};
+    BasicMatrix (const BasicMatrix &) = default;
+    BasicMatrix (BasicMatrix &&) = default;
+    template <class E>
+    BasicMatrix (const matrix_expr::Expr<E> &);
+    static BasicMatrix view (DType *, int, int); //rows x cols matrix over memory owned elsewhere, written through
+    bool is_view () const { return this->matrix.is_view(); };
+    BasicMatrix& fill_zeros();
+    BasicMatrix& fill_ones();
+    BasicMatrix& fill_rand(); //standard normal, next stream of the global seed (Random.hpp)
+    BasicMatrix& fill_rand(uint64_t, uint64_t = 0); //standard normal of the given seed and stream
+    BasicMatrix dot (const BasicMatrix &, bool = false, bool = false) const;
+    BasicMatrix dot_bias (const BasicMatrix &, const BasicMatrix &, bool = false, BasicMatrix * = nullptr) const; //fused this x W + bias (+ ReLU, mask)
+    static void gemm (compute_type, const BasicMatrix &, bool, const BasicMatrix &, bool, compute_type, BasicMatrix &);
+    template <class U>
+    BasicMatrix<U> cast () const; //elementwise conversion to another element type
+    BasicMatrix T () const;
+    BasicMatrix sum (const int &) const;
+    BasicMatrix argmax (const int &) const;
+    BasicMatrix max (const int &) const;
+    tuple<int, int> shape () const;
+    BasicMatrix reshape (int, int) const &;
+    BasicMatrix reshape (int, int) &&;
+    double ndim () const;
+    BasicMatrix mean (const int &) const;
+    BasicMatrix log () const &;
+    BasicMatrix log () &&;
+    BasicMatrix exp () const &;
+    BasicMatrix exp () &&;
+    BasicMatrix sqrt () const &;
+    BasicMatrix sqrt () &&;
+    matrix_expr::Terminal<DType> broadcast (tuple<int, int>) const &; //zero-copy view
+    matrix_expr::Terminal<DType> broadcast (tuple<int, int>) &&;
     static tuple<int, int> broadcast_shape(tuple<int, int>, tuple<int, int>);
-    Matrix operator * (Matrix);
-    Matrix operator * (double);
-    Matrix operator + (Matrix &);
-    Matrix operator + (double);
-    Matrix operator - (Matrix &);
-    Matrix operator - ();
-    Matrix operator - (double);
-    Matrix operator / (Matrix &&);
-    Matrix operator / (const double &);
-    Matrix operator ^ (const double &); //Matrices-powering
-    Matrix& operator = (const Matrix &);
-    Matrix& operator = (const double &);
-    bool operator == (const Matrix & mtx);
-    Matrix operator > (double);
-    double& operator () (const int &, const int &);
-    void print(bool np_insert = false);
-};
\ No newline at end of file
+    matrix_expr::Terminal<DType> row_range (int, int) const &; //zero-copy view of rows [first, last)
+    matrix_expr::Terminal<DType> row_range (int, int) &&;
+    BasicMatrix operator ^ (const double &) const &; //Matrices-powering
+    BasicMatrix operator ^ (const double &) &&;
+    BasicMatrix& operator = (const BasicMatrix &) = default;
+    BasicMatrix& operator = (BasicMatrix &&) = default;
+    BasicMatrix& operator = (const compute_type &);
+    template <class E>
+    BasicMatrix& operator = (const matrix_expr::Expr<E> &);
+    // In-place elementwise operations, r is a BasicMatrix, an expression or a number
+    template <class R>
+    BasicMatrix& operator += (R &&r);
+    template <class R>
+    BasicMatrix& operator -= (R &&r);
+    template <class R>
+    BasicMatrix& operator *= (R &&r);
+    template <class R>
+    BasicMatrix& operator /= (R &&r);
+    bool operator == (const BasicMatrix & mtx) const;
+    BasicMatrix operator > (double) const;
+    DType& operator () (const int &, const int &);
+    DType operator () (const int &, const int &) const;
+    DType* data () { return this->matrix.data(); };
+    const DType* data () const { return this->matrix.data(); };
+    void print(bool np_insert = false) const;
+};
+
+using Matrix = BasicMatrix<double>;
+using MatrixF = BasicMatrix<float>;
+using MatrixBF16 = BasicMatrix<bfloat16>;
+
+#include "MatrixExpr.hpp"
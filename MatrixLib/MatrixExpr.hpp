@@ -0,0 +1,401 @@
+#pragma once
+#include <memory>
+#include <tuple>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+#include "Parallel.hpp"
+
+/***********************************************************
+ * matrix_expr - lazy expression templates for the Matrix
+ * elementwise arithmetic. Operators + - * / and unary minus
+ * don't compute anything, they build a tree of nodes which
+ * is evaluated in a single fused loop once it's assigned
+ * to a Matrix (or used where a Matrix is expected).
+ * --------------------------------------------------------
+ * nodes:
+ *   Terminal - Matrix operand, referenced if it's an lvalue
+ *   and owned if it's a temporary. Broadcasting is a view
+ *   with zero row or column stride and row_range() a view
+ *   into a range of rows, nothing gets copied.
+ *   Scalar - number operand
+ *   Binary - elementwise binary operation
+ *   Unary - elementwise unary operation
+ * --------------------------------------------------------
+ * Every node can be read by flat index with operator [],
+ * unless broadcasted() is set, and by (row, col) with at().
+ * Evaluation picks the flat loop whenever it can. It writes
+ * in place unless aliases() finds an operand reading the
+ * target's memory other than element by element (e.g. a
+ * row_range() or a broadcast of the target), then the result
+ * is evaluated aside.
+ * Nodes compute in value_type, the compute type of their
+ * matrices' elements. Operands of different element types
+ * can't be mixed, cast() one of them first.
+ **********************************************************/
+namespace matrix_expr {
+
+    struct ExprBase {};
+
+    template <class E>
+    class Expr : public ExprBase {
+    public:
+        const E& self () const { return static_cast<const E&>(*this); }
+        tuple<int, int> shape () const { return tuple<int, int>(self().rows(), self().cols()); }
+        auto eval () const { return BasicMatrix<typename E::storage_type>(*this); }
+    };
+
+    inline void check_broadcast (int rows, int cols, int desire_r, int desire_c) {
+        if ((rows != desire_r && rows != 1) || (cols != desire_c && cols != 1))
+            throw std::runtime_error("Error: Matrix (" + std::to_string(rows) + ", " + std::to_string(cols) +
+                ") cannot be broadcasted to shape (" + std::to_string(desire_r) + ", " + std::to_string(desire_c) + ")!\n");
+    }
+
+    template <class DType>
+    class Terminal : public Expr<Terminal<DType>> {
+    private:
+        std::shared_ptr<BasicMatrix<DType>> owned; //keeps temporaries alive
+        const DType *ptr;
+        int row_size, col_size;
+        long row_stride, col_stride; //0 along a dimension of size 1
+        void init (const BasicMatrix<DType> &mtx) {
+            this->ptr = mtx.data();
+            this->row_size = std::get<0>(mtx.shape());
+            this->col_size = std::get<1>(mtx.shape());
+            this->row_stride = (this->row_size == 1) ? 0 : this->col_size;
+            this->col_stride = (this->col_size == 1) ? 0 : 1;
+        }
+    public:
+        using value_type = compute_t<DType>;
+        using storage_type = DType;
+        explicit Terminal (const BasicMatrix<DType> &mtx) { this->init(mtx); };
+        explicit Terminal (BasicMatrix<DType> &&mtx) : owned(std::make_shared<BasicMatrix<DType>>(std::move(mtx))) {
+            this->init(*this->owned);
+        };
+        int rows () const { return row_size; }
+        int cols () const { return col_size; }
+        bool broadcasted () const { return (row_stride == 0 && row_size > 1) || (col_stride == 0 && col_size > 1); }
+        value_type operator [] (long i) const { return value_type(ptr[i]); }
+        value_type at (int row, int col) const { return value_type(ptr[row * row_stride + col * col_stride]); }
+        // Zero-copy view of the operand stretched to the given shape
+        Terminal broadcast (int rows, int cols) const {
+            check_broadcast(this->row_size, this->col_size, rows, cols);
+            Terminal view = (*this);
+            view.row_size = rows;
+            view.col_size = cols;
+            return view;
+        }
+        // Zero-copy view of the rows [first, last) of the operand
+        Terminal slice_rows (int first, int last) const {
+            if (first < 0 || last > this->row_size || first >= last)
+                throw std::runtime_error("Error: rows [" + std::to_string(first) + ", " + std::to_string(last) +
+                    ") are out of a Matrix with " + std::to_string(this->row_size) + " rows!\n");
+            Terminal view = (*this);
+            view.ptr += first * this->row_stride;
+            view.row_size = last - first;
+            if (view.row_size == 1)
+                view.row_stride = 0;
+            return view;
+        }
+        // An owned temporary of the result's shape can give its buffer
+        // away to the result, as every element is read before it's written
+        BasicMatrix<DType>* stealable (int rows, int cols) const {
+            bool fits = this->owned && this->owned.use_count() == 1 && !this->broadcasted() && !this->owned->is_view()
+                        && this->ptr == this->owned->data() && this->row_size == rows && this->col_size == cols;
+            return fits ? this->owned.get() : nullptr;
+        }
+        // Whether the operand reads memory in [begin, end) at other elements than
+        // the same flat index of a matrix of its shape stored there
+        bool aliases (const void *begin, const void *end) const {
+            const char *first = reinterpret_cast<const char *>(this->ptr);
+            const char *last = first + ((long)(this->row_size - 1) * this->row_stride
+                                        + (long)(this->col_size - 1) * this->col_stride + 1) * sizeof(DType);
+            if (last <= static_cast<const char *>(begin) || first >= static_cast<const char *>(end))
+                return false;
+            bool same = first == begin && !this->broadcasted() && last == end
+                        && (this->row_size == 1 || this->row_stride == this->col_size);
+            return !same;
+        }
+    };
+
+    template <class V>
+    class Scalar : public Expr<Scalar<V>> {
+    private:
+        V value;
+    public:
+        using value_type = V;
+        using storage_type = void;
+        explicit Scalar (V value) : value(value) {};
+        int rows () const { return 1; }
+        int cols () const { return 1; }
+        bool broadcasted () const { return false; }
+        V operator [] (long) const { return value; }
+        V at (int, int) const { return value; }
+        bool aliases (const void *, const void *) const { return false; }
+    };
+
+    template <class N>
+    struct is_scalar_node : std::false_type {};
+    template <class V>
+    struct is_scalar_node<Scalar<V>> : std::true_type {};
+
+    // Brings an operand to the shape of the result. Matrices become
+    // broadcast views, scalars fit any shape, and subexpressions are
+    // evaluated by (row, col) if they are smaller than the result.
+    template <class DType>
+    Terminal<DType> fit (Terminal<DType> t, int rows, int cols) {
+        return t.broadcast(rows, cols);
+    }
+
+    template <class V>
+    Scalar<V> fit (Scalar<V> s, int, int) {
+        return s;
+    }
+
+    template <class E>
+    E fit (E e, int rows, int cols) {
+        check_broadcast(e.rows(), e.cols(), rows, cols);
+        return e;
+    }
+
+    // Whether an operand of the given shape can't be read by flat index
+    template <class E>
+    bool needs_2d (const E &e, int rows, int cols) {
+        if constexpr (is_scalar_node<E>::value)
+            return false;
+        else
+            return e.broadcasted() || e.rows() != rows || e.cols() != cols;
+    }
+
+    template <class Op, class L, class R>
+    class Binary : public Expr<Binary<Op, L, R>> {
+        static_assert(std::is_same<typename L::value_type, typename R::value_type>::value,
+                      "Operands have different element types, cast() one of them first");
+    private:
+        int row_size, col_size;
+        L l;
+        R r;
+        bool is_broadcasted;
+    public:
+        using value_type = typename L::value_type;
+        using storage_type = std::conditional_t<is_scalar_node<L>::value, typename R::storage_type, typename L::storage_type>;
+        Binary (L l, R r) : row_size(std::max(l.rows(), r.rows())), col_size(std::max(l.cols(), r.cols())),
+            l(fit(std::move(l), row_size, col_size)), r(fit(std::move(r), row_size, col_size)) {
+            this->is_broadcasted = needs_2d(this->l, row_size, col_size) || needs_2d(this->r, row_size, col_size);
+        };
+        int rows () const { return row_size; }
+        int cols () const { return col_size; }
+        bool broadcasted () const { return is_broadcasted; }
+        value_type operator [] (long i) const { return Op::apply(l[i], r[i]); }
+        value_type at (int row, int col) const { return Op::apply(l.at(row, col), r.at(row, col)); }
+        BasicMatrix<storage_type>* stealable (int rows, int cols) const {
+            if constexpr (is_scalar_node<L>::value)
+                return r.stealable(rows, cols);
+            else if constexpr (is_scalar_node<R>::value)
+                return l.stealable(rows, cols);
+            else if constexpr (std::is_same<typename L::storage_type, typename R::storage_type>::value) {
+                BasicMatrix<storage_type> *buffer = l.stealable(rows, cols);
+                return buffer ? buffer : r.stealable(rows, cols);
+            } else
+                return l.stealable(rows, cols);
+        }
+        bool aliases (const void *begin, const void *end) const { return l.aliases(begin, end) || r.aliases(begin, end); }
+    };
+
+    template <class Op, class A>
+    class Unary : public Expr<Unary<Op, A>> {
+    private:
+        A a;
+    public:
+        using value_type = typename A::value_type;
+        using storage_type = typename A::storage_type;
+        explicit Unary (A a) : a(std::move(a)) {};
+        int rows () const { return a.rows(); }
+        int cols () const { return a.cols(); }
+        bool broadcasted () const { return a.broadcasted(); }
+        value_type operator [] (long i) const { return Op::apply(a[i]); }
+        value_type at (int row, int col) const { return Op::apply(a.at(row, col)); }
+        BasicMatrix<storage_type>* stealable (int rows, int cols) const { return a.stealable(rows, cols); }
+        bool aliases (const void *begin, const void *end) const { return a.aliases(begin, end); }
+    };
+
+    struct Add { template <class V> static V apply (V a, V b) { return a + b; } };
+    struct Sub { template <class V> static V apply (V a, V b) { return a - b; } };
+    struct Mul { template <class V> static V apply (V a, V b) { return a * b; } };
+    struct Div { template <class V> static V apply (V a, V b) { return a / b; } };
+    struct Neg { template <class V> static V apply (V a) { return -a; } };
+
+    // Wrapping of operands into nodes
+    template <class DType>
+    Terminal<DType> node (const BasicMatrix<DType> &mtx) { return Terminal<DType>(mtx); }
+    template <class DType>
+    Terminal<DType> node (BasicMatrix<DType> &&mtx) { return Terminal<DType>(std::move(mtx)); }
+    template <class E>
+    E node (const Expr<E> &e) { return e.self(); }
+    template <class E>
+    E node (Expr<E> &&e) { return static_cast<E &&>(e); }
+
+    template <class T>
+    struct is_matrix_type : std::false_type {};
+    template <class DType>
+    struct is_matrix_type<BasicMatrix<DType>> : std::true_type {};
+
+    template <class T>
+    using is_matrix = is_matrix_type<std::decay_t<T>>;
+    template <class T>
+    using is_expr = std::is_base_of<ExprBase, std::decay_t<T>>;
+    template <class T>
+    using is_scalar = std::is_arithmetic<std::decay_t<T>>;
+    template <class T>
+    using is_operand = std::integral_constant<bool, is_matrix<T>::value || is_expr<T>::value>;
+
+    // At least one side has to be a matrix or an expression, the other may be a number
+    template <class L, class R>
+    using enable_binary = std::enable_if_t<(is_operand<L>::value && (is_operand<R>::value || is_scalar<R>::value)) ||
+                                           (is_scalar<L>::value && is_operand<R>::value)>;
+
+    // Numbers take the value type of the other operand
+    template <class Op, class L, class R>
+    auto make_binary (L &&l, R &&r) {
+        if constexpr (is_scalar<L>::value) {
+            auto r_node = node(std::forward<R>(r));
+            using V = typename decltype(r_node)::value_type;
+            return Binary<Op, Scalar<V>, decltype(r_node)>(Scalar<V>(V(l)), std::move(r_node));
+        } else if constexpr (is_scalar<R>::value) {
+            auto l_node = node(std::forward<L>(l));
+            using V = typename decltype(l_node)::value_type;
+            return Binary<Op, decltype(l_node), Scalar<V>>(std::move(l_node), Scalar<V>(V(r)));
+        } else {
+            auto l_node = node(std::forward<L>(l));
+            auto r_node = node(std::forward<R>(r));
+            return Binary<Op, decltype(l_node), decltype(r_node)>(std::move(l_node), std::move(r_node));
+        }
+    }
+}
+
+template <class L, class R, class = matrix_expr::enable_binary<L, R>>
+auto operator + (L &&l, R &&r) { return matrix_expr::make_binary<matrix_expr::Add>(std::forward<L>(l), std::forward<R>(r)); }
+
+template <class L, class R, class = matrix_expr::enable_binary<L, R>>
+auto operator - (L &&l, R &&r) { return matrix_expr::make_binary<matrix_expr::Sub>(std::forward<L>(l), std::forward<R>(r)); }
+
+template <class L, class R, class = matrix_expr::enable_binary<L, R>>
+auto operator * (L &&l, R &&r) { return matrix_expr::make_binary<matrix_expr::Mul>(std::forward<L>(l), std::forward<R>(r)); }
+
+template <class L, class R, class = matrix_expr::enable_binary<L, R>>
+auto operator / (L &&l, R &&r) { return matrix_expr::make_binary<matrix_expr::Div>(std::forward<L>(l), std::forward<R>(r)); }
+
+template <class A, class = std::enable_if_t<matrix_expr::is_operand<A>::value>>
+auto operator - (A &&a) {
+    auto a_node = matrix_expr::node(std::forward<A>(a));
+    return matrix_expr::Unary<matrix_expr::Neg, decltype(a_node)>(std::move(a_node));
+}
+
+
+// Evaluation of an expression: a single fused pass over the result
+template <class DType>
+template <class E>
+BasicMatrix<DType>::BasicMatrix (const matrix_expr::Expr<E> &expr) {
+    static_assert(std::is_same<typename E::value_type, compute_type>::value,
+                  "Expression computes in another type than the matrix, cast() its operands first");
+    const E &e = expr.self();
+    this->row_size = e.rows();
+    this->col_size = e.cols();
+    // Reuse the buffer of a temporary operand instead of allocating
+    BasicMatrix *buffer = nullptr;
+    if constexpr (std::is_same<typename E::storage_type, DType>::value)
+        buffer = e.stealable(this->row_size, this->col_size);
+    if (buffer)
+        this->matrix = std::move(buffer->matrix);
+    else
+        this->matrix.resize((size_t)this->row_size * this->col_size);
+    this->assign(e);
+};
+
+template <class DType>
+template <class E>
+BasicMatrix<DType>& BasicMatrix<DType>::operator = (const matrix_expr::Expr<E> &expr) {
+    const E &e = expr.self();
+    // Evaluated aside if the shape changes or the expression reads this
+    // matrix at other elements than the one being written
+    if (e.rows() != this->row_size || e.cols() != this->col_size
+        || this->matrix.size() != (size_t)e.rows() * e.cols()
+        || e.aliases(this->matrix.data(), this->matrix.data() + this->matrix.size())) {
+        (*this) = BasicMatrix(e);
+    } else {
+        this->assign(e);
+    }
+    return (*this);
+};
+
+template <class DType>
+template <class Op, class R>
+BasicMatrix<DType>& BasicMatrix<DType>::update (R &&r) {
+    auto e = matrix_expr::make_binary<Op>(static_cast<const BasicMatrix &>(*this), std::forward<R>(r));
+    if (e.rows() != this->row_size || e.cols() != this->col_size)
+        throw std::runtime_error("Error: Matrix (" + std::to_string(this->row_size) + ", " + std::to_string(this->col_size) +
+            ") cannot be updated in place with a result of shape (" + std::to_string(e.rows()) + ", " + std::to_string(e.cols()) + ")!\n");
+    // The operand may read this matrix at other elements, e.g. a -= a.row_range(0, 1)
+    if (e.aliases(this->matrix.data(), this->matrix.data() + this->matrix.size()))
+        (*this) = BasicMatrix(e);
+    else
+        this->assign(e);
+    return (*this);
+};
+
+template <class DType>
+template <class R>
+BasicMatrix<DType>& BasicMatrix<DType>::operator += (R &&r) { return this->update<matrix_expr::Add>(std::forward<R>(r)); };
+
+template <class DType>
+template <class R>
+BasicMatrix<DType>& BasicMatrix<DType>::operator -= (R &&r) { return this->update<matrix_expr::Sub>(std::forward<R>(r)); };
+
+template <class DType>
+template <class R>
+BasicMatrix<DType>& BasicMatrix<DType>::operator *= (R &&r) { return this->update<matrix_expr::Mul>(std::forward<R>(r)); };
+
+template <class DType>
+template <class R>
+BasicMatrix<DType>& BasicMatrix<DType>::operator /= (R &&r) { return this->update<matrix_expr::Div>(std::forward<R>(r)); };
+
+template <class DType>
+template <class E>
+void BasicMatrix<DType>::assign (const E &e) {
+    DType *out = this->matrix.data();
+    int rows = this->row_size, cols = this->col_size;
+
+    if (!e.broadcasted()) {
+        long size = (long)rows * cols;
+        exec::parallel_for(size, exec::ELEMENTWISE, [&](long begin, long end) {
+            #pragma omp simd
+            for (long i = begin; i < end; i++)
+                out[i] = DType(e[i]);
+        });
+    } else {
+        exec::parallel_for(rows, exec::ELEMENTWISE, [&](long begin, long end) {
+            for (int i = begin; i < end; i++) {
+                DType *row = out + (long)i * cols;
+                #pragma omp simd
+                for (int j = 0; j < cols; j++)
+                    row[j] = DType(e.at(i, j));
+            }
+        }, cols);
+    }
+};
+
+template <class DType>
+template <class U>
+BasicMatrix<U> BasicMatrix<DType>::cast () const {
+    BasicMatrix<U> result(this->row_size, this->col_size);
+    long size = (long)this->row_size * this->col_size;
+
+    exec::parallel_for(size, exec::COPY, [&](long begin, long end) {
+        #pragma omp simd
+        for (long i = begin; i < end; i++)
+            result.matrix[i] = U(compute_t<U>(compute_type(this->matrix[i])));
+    });
+    return result;
+};
@@ -0,0 +1,77 @@
+#include "Parallel.hpp"
+
+#include <cstdlib>
+#include <atomic>
+
+
+namespace {
+
+    // Default grain sizes: about the work a thread does in the time
+    // a fork/join takes (a few microseconds)
+    const long DEFAULT_GRAIN[exec::KIND_COUNT] = {
+        32768, //ELEMENTWISE
+        4096, //TRANSCENDENTAL
+        32768, //REDUCTION
+        65536, //COPY
+        1 << 20, //GEMM, in flops
+        8192, //RANDOM
+    };
+
+    struct Policy {
+        std::atomic<int> threads;
+        std::atomic<long> grain[exec::KIND_COUNT];
+
+        Policy () {
+            int count = 1;
+#ifdef _OPENMP
+            count = omp_get_max_threads();
+#endif
+            if (const char *env = std::getenv("MATRIX_NUM_THREADS"))
+                count = std::max(1, std::atoi(env));
+            this->threads = count;
+
+            double scale = 1.0;
+            if (const char *env = std::getenv("MATRIX_GRAIN_SCALE"))
+                scale = std::max(0.0, std::atof(env));
+            for (int kind = 0; kind < exec::KIND_COUNT; kind++)
+                this->grain[kind] = (long)(DEFAULT_GRAIN[kind] * scale);
+        }
+    };
+
+    Policy &policy () {
+        static Policy instance;
+        return instance;
+    }
+}
+
+
+int exec::threads (long work, Kind kind) {
+#ifdef _OPENMP
+    if (omp_in_parallel())
+        return 1;
+#endif
+    Policy &p = policy();
+    int max_threads = p.threads.load(std::memory_order_relaxed);
+    long size = p.grain[kind].load(std::memory_order_relaxed);
+    if (max_threads <= 1 || work < size)
+        return 1;
+    if (size <= 0)
+        return max_threads;
+    return (int)std::min<long>(max_threads, work / size);
+}
+
+int exec::num_threads () {
+    return policy().threads.load(std::memory_order_relaxed);
+}
+
+void exec::set_num_threads (int threads) {
+    policy().threads.store(std::max(1, threads), std::memory_order_relaxed);
+}
+
+long exec::grain (Kind kind) {
+    return policy().grain[kind].load(std::memory_order_relaxed);
+}
+
+void exec::set_grain (Kind kind, long size) {
+    policy().grain[kind].store(std::max(0L, size), std::memory_order_relaxed);
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/***********************************************************
+ * exec - execution policy of the Matrix kernels. Decides per
+ * call whether a kernel is worth an OpenMP parallel region
+ * and how many threads it gets, so that small matrices (bias
+ * rows, softmax columns, 1x1 results) run serially without
+ * paying for a fork/join.
+ * --------------------------------------------------------
+ * Every kernel kind has a grain size: the least amount of work
+ * (elements, or flops for GEMM) worth giving to one thread.
+ * A kernel with less work than that runs in the calling thread,
+ * otherwise it gets at most work / grain threads. Kernels called
+ * from inside a parallel region always run serially, so regions
+ * are never nested.
+ * --------------------------------------------------------
+ * Runtime knobs:
+ *    -set_num_threads(n) or MATRIX_NUM_THREADS=n limits the
+ *    thread count (default: omp_get_max_threads()).
+ *    -set_grain(kind, size) changes one grain size,
+ *    MATRIX_GRAIN_SCALE=x multiplies all defaults by x
+ *    (0 makes every kernel parallel).
+ **********************************************************/
+namespace exec {
+
+    enum Kind {
+        ELEMENTWISE, //arithmetic, fills, comparisons
+        TRANSCENDENTAL, //exp, log, pow
+        REDUCTION, //sum, mean, max, argmax
+        COPY, //transposes, packing, gathers
+        GEMM, //flops of a matrix product
+        RANDOM, //random number generation
+        KIND_COUNT
+    };
+
+    int threads (long work, Kind kind);
+    int num_threads ();
+    void set_num_threads (int threads);
+    long grain (Kind kind);
+    void set_grain (Kind kind, long size);
+
+    // Splits [0, n) into equal contiguous chunks, chunk id of count
+    inline std::pair<long, long> chunk (long n, int id, int count) {
+        long base = n / count, extra = n % count;
+        long begin = id * base + std::min<long>(id, extra);
+        return std::pair<long, long>(begin, begin + base + (id < extra ? 1 : 0));
+    }
+
+    /*
+    * Calls body(begin, end) over the chunks of [0, n), one per thread,
+    * or body(0, n) in the calling thread if the work is too small.
+    * Parameters:
+    *   long n - number of iterations
+    *   Kind kind - kernel kind, selects the grain size
+    *   F body - callable (long begin, long end)
+    *   long cost - work of one iteration, in units of the grain
+    */
+    template <class F>
+    void parallel_for (long n, Kind kind, F body, long cost = 1) {
+        int count = (int)std::min<long>(threads(n * cost, kind), n);
+        if (count <= 1) {
+            if (n > 0)
+                body(0L, n);
+            return;
+        }
+        #pragma omp parallel num_threads(count)
+        {
+#ifdef _OPENMP
+            std::pair<long, long> range = chunk(n, omp_get_thread_num(), omp_get_num_threads());
+#else
+            std::pair<long, long> range(0L, n);
+#endif
+            if (range.first < range.second)
+                body(range.first, range.second);
+        }
+    }
+
+    /*
+    * Reduces [0, n): every chunk is turned into a partial result by
+    * body(begin, end), partials are combined in chunk order, so the
+    * result only depends on the thread count, not on timing. The
+    * partials live in a per-thread scratch vector that only grows,
+    * so a reduction doesn't allocate once it ran with as many threads.
+    */
+    template <class R, class F, class Op>
+    R parallel_reduce (long n, Kind kind, R init, F body, Op combine, long cost = 1) {
+        int count = (int)std::min<long>(threads(n * cost, kind), n);
+        if (count <= 1)
+            return (n > 0) ? combine(init, body(0L, n)) : init;
+
+        // Never in use twice in a thread: bodies run serially inside the region.
+        // The other threads see the caller's scratch through the pointer only.
+        struct Slot { R value; }; //not a packed std::vector<bool>
+        static thread_local std::vector<Slot> scratch;
+        if ((int)scratch.size() < count)
+            scratch.resize(count, Slot{ init });
+        Slot *partial = scratch.data();
+        int started = count;
+        #pragma omp parallel num_threads(count)
+        {
+#ifdef _OPENMP
+            int id = omp_get_thread_num();
+            std::pair<long, long> range = chunk(n, id, omp_get_num_threads());
+            #pragma omp single nowait
+            started = omp_get_num_threads();
+#else
+            int id = 0;
+            std::pair<long, long> range(0L, n);
+            started = 1;
+#endif
+            partial[id].value = body(range.first, range.second);
+        }
+        // count <= n, so no chunk of a started thread is empty
+        R result = init;
+        for (int i = 0; i < started; i++)
+            result = combine(result, partial[i].value);
+        return result;
+    }
+}
@@ -0,0 +1,190 @@
+#include "QGemm.hpp"
+#include "Parallel.hpp"
+
+#include <cstring>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using qgemm::NR;
+using qgemm::KGROUP;
+
+
+namespace {
+
+    // Rows of A per micro-kernel call and per parallel job
+#if defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__))
+    const int MR = 6;
+#elif defined(__AVX2__)
+    const int MR = 2; //the widened operands take twice the registers
+#else
+    const int MR = 4;
+#endif
+    const int MB = 8 * MR;
+
+    inline int32_t load_group (const uint8_t *a) {
+        int32_t value;
+        std::memcpy(&value, a, sizeof(value));
+        return value;
+    }
+
+#if defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__))
+    inline __m256i dot_add (__m256i acc, __m256i a, __m256i b) {
+#if defined(__AVXVNNI__)
+        return _mm256_dpbusd_avx_epi32(acc, a, b);
+#else
+        return _mm256_dpbusd_epi32(acc, a, b);
+#endif
+    }
+
+    // tile[ROWS x NR] = A[ROWS x 4 kgroups] x panel
+    template <int ROWS>
+    void micro_kernel (const uint8_t *a, int lda, const int8_t *panel, int kgroups, int32_t *tile) {
+        __m256i acc[ROWS][2];
+        for (int r = 0; r < ROWS; r++)
+            acc[r][0] = acc[r][1] = _mm256_setzero_si256();
+
+        for (int g = 0; g < kgroups; g++) {
+            __m256i b0 = _mm256_load_si256((const __m256i *)(panel + g * NR * KGROUP));
+            __m256i b1 = _mm256_load_si256((const __m256i *)(panel + g * NR * KGROUP + 32));
+            for (int r = 0; r < ROWS; r++) {
+                __m256i av = _mm256_set1_epi32(load_group(a + (long)r * lda + g * KGROUP));
+                acc[r][0] = dot_add(acc[r][0], av, b0);
+                acc[r][1] = dot_add(acc[r][1], av, b1);
+            }
+        }
+        for (int r = 0; r < ROWS; r++) {
+            _mm256_storeu_si256((__m256i *)(tile + r * NR), acc[r][0]);
+            _mm256_storeu_si256((__m256i *)(tile + r * NR + 8), acc[r][1]);
+        }
+    }
+
+    const char *KERNEL = "vnni";
+#elif defined(__AVX2__)
+    // Every 32 bytes of a panel hold 8 columns x 4 k. Widened to int16,
+    // vpmaddwd leaves two partial sums per column (k0 + k1, k2 + k3),
+    // which are added pairwise once at the end.
+    template <int ROWS>
+    void micro_kernel (const uint8_t *a, int lda, const int8_t *panel, int kgroups, int32_t *tile) {
+        __m256i acc[ROWS][4];
+        for (int r = 0; r < ROWS; r++)
+            for (int h = 0; h < 4; h++)
+                acc[r][h] = _mm256_setzero_si256();
+
+        for (int g = 0; g < kgroups; g++) {
+            __m256i b0 = _mm256_load_si256((const __m256i *)(panel + g * NR * KGROUP));
+            __m256i b1 = _mm256_load_si256((const __m256i *)(panel + g * NR * KGROUP + 32));
+            __m256i b[4] = {
+                _mm256_cvtepi8_epi16(_mm256_castsi256_si128(b0)), //columns 0-3
+                _mm256_cvtepi8_epi16(_mm256_extracti128_si256(b0, 1)), //columns 4-7
+                _mm256_cvtepi8_epi16(_mm256_castsi256_si128(b1)), //columns 8-11
+                _mm256_cvtepi8_epi16(_mm256_extracti128_si256(b1, 1)) //columns 12-15
+            };
+            for (int r = 0; r < ROWS; r++) {
+                __m256i av = _mm256_cvtepu8_epi16(_mm_set1_epi32(load_group(a + (long)r * lda + g * KGROUP)));
+                for (int h = 0; h < 4; h++)
+                    acc[r][h] = _mm256_add_epi32(acc[r][h], _mm256_madd_epi16(av, b[h]));
+            }
+        }
+        for (int r = 0; r < ROWS; r++) {
+            for (int h = 0; h < 2; h++) {
+                // [c0 c1 c4 c5 | c2 c3 c6 c7] -> [c0 .. c7]
+                __m256i sums = _mm256_hadd_epi32(acc[r][2 * h], acc[r][2 * h + 1]);
+                sums = _mm256_permute4x64_epi64(sums, 0xD8);
+                _mm256_storeu_si256((__m256i *)(tile + r * NR + 8 * h), sums);
+            }
+        }
+    }
+
+    const char *KERNEL = "avx2";
+#else
+    template <int ROWS>
+    void micro_kernel (const uint8_t *a, int lda, const int8_t *panel, int kgroups, int32_t *tile) {
+        int32_t acc[ROWS][NR] = {};
+        for (int g = 0; g < kgroups; g++) {
+            const int8_t *b = panel + g * NR * KGROUP;
+            for (int r = 0; r < ROWS; r++) {
+                const uint8_t *a_group = a + (long)r * lda + g * KGROUP;
+                for (int j = 0; j < NR; j++)
+                    for (int q = 0; q < KGROUP; q++)
+                        acc[r][j] += (int32_t)a_group[q] * (int32_t)b[j * KGROUP + q];
+            }
+        }
+        for (int r = 0; r < ROWS; r++)
+            for (int j = 0; j < NR; j++)
+                tile[r * NR + j] = acc[r][j];
+    }
+
+    const char *KERNEL = "portable";
+#endif
+
+    // Dispatches the row count of an edge tile to its instantiation
+    template <int ROWS = MR>
+    void micro_kernel_rows (int rows, const uint8_t *a, int lda, const int8_t *panel, int kgroups, int32_t *tile) {
+        if (rows == ROWS)
+            micro_kernel<ROWS>(a, lda, panel, kgroups, tile);
+        else if constexpr (ROWS > 1)
+            micro_kernel_rows<ROWS - 1>(rows, a, lda, panel, kgroups, tile);
+    }
+}
+
+
+qgemm::PackedB qgemm::pack_b (const int8_t *b, int k, int n) {
+    PackedB packed;
+    packed.k = k;
+    packed.n = n;
+    packed.k_padded = (k + KGROUP - 1) / KGROUP * KGROUP;
+    int panels = (n + NR - 1) / NR;
+    long panel_size = (long)packed.k_padded * NR;
+    packed.panels.assign(panels * panel_size, 0);
+    packed.column_sums.assign(n, 0);
+
+    // Panel p holds element (k, j) at p * panel_size + (k / 4) * NR * 4 + (j % NR) * 4 + k % 4
+    for (int p = 0; p < panels; p++) {
+        int8_t *panel = packed.panels.data() + p * panel_size;
+        for (int j = p * NR; j < std::min(n, (p + 1) * NR); j++) {
+            for (int q = 0; q < k; q++) {
+                int8_t value = b[(long)q * n + j];
+                panel[(q / KGROUP) * NR * KGROUP + (j % NR) * KGROUP + q % KGROUP] = value;
+                packed.column_sums[j] += value;
+            }
+        }
+    }
+    return packed;
+}
+
+void qgemm::gemm (int m, const uint8_t *a, int lda, const PackedB &b, int32_t *c, int ldc) {
+    int kgroups = b.k_padded / KGROUP;
+    int panels = (b.n + NR - 1) / NR;
+    int row_blocks = (m + MB - 1) / MB;
+    int jobs = row_blocks * panels;
+    long panel_size = (long)b.k_padded * NR;
+
+    auto run_job = [&](int job) {
+        int block = job / panels, p = job % panels;
+        const int8_t *panel = b.panels.data() + p * panel_size;
+        int cols = std::min(NR, b.n - p * NR);
+        alignas(32) int32_t tile[MR * NR];
+        for (int i = block * MB; i < std::min(m, (block + 1) * MB); i += MR) {
+            int rows = std::min(MR, m - i);
+            micro_kernel_rows(rows, a + (long)i * lda, lda, panel, kgroups, tile);
+            for (int r = 0; r < rows; r++)
+                std::copy(tile + r * NR, tile + r * NR + cols, c + (long)(i + r) * ldc + p * NR);
+        }
+    };
+
+    int count = std::min(exec::threads(2L * m * b.n * b.k, exec::GEMM), jobs);
+    if (count > 1) {
+        #pragma omp parallel for schedule(dynamic) num_threads(count)
+        for (int job = 0; job < jobs; job++)
+            run_job(job);
+    } else {
+        for (int job = 0; job < jobs; job++)
+            run_job(job);
+    }
+}
+
+const char *qgemm::kernel_name () {
+    return KERNEL;
+}
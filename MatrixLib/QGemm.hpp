@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Workspace.hpp"
+
+/***********************************************************
+ * qgemm - int8 matrix multiplication engine for quantized
+ * inference. Computes
+ *      C = A x B
+ * where A is uint8 (activations with a zero point), B is int8
+ * (weights) and C accumulates exactly in int32.
+ * --------------------------------------------------------
+ * B is packed once (weights don't change between calls) into
+ * panels of NR columns, every column keeps groups of 4
+ * consecutive k, the layout of the u8 x s8 dot product
+ * instructions. K is padded to a multiple of 4 and N to a
+ * multiple of NR with zeros. Micro-kernels, picked at compile
+ * time:
+ *    -AVX-VNNI / AVX512-VNNI: vpdpbusd, 4 multiply-adds per
+ *    int32 lane and instruction.
+ *    -AVX2: bytes are widened to int16 and multiplied with
+ *    vpmaddwd. vpmaddubsw is not used, it saturates for
+ *    full-range u8 x s8 products.
+ *    -Portable C++ otherwise.
+ * All of them are exact, so results don't depend on the ISA.
+ * Tiles of C are split between threads by the exec policy.
+ **********************************************************/
+namespace qgemm {
+
+    const int NR = 16; //columns of a packed panel
+    const int KGROUP = 4; //consecutive k of a column kept together
+
+    struct PackedB {
+        int k = 0, n = 0; //logical shape
+        int k_padded = 0; //k rounded up to KGROUP, the row length A needs
+        std::vector<int8_t, workspace::Allocator<int8_t>> panels;
+        std::vector<int32_t> column_sums; //sum over k of every column, for zero point corrections
+    };
+
+    /*
+    * Packs the row-major k x n int8 matrix b
+    */
+    PackedB pack_b (const int8_t *b, int k, int n);
+
+    /*
+    * Parameters:
+    *   int m - rows of A and C
+    *   const uint8_t *a - m x b.k_padded, leading dimension lda,
+    *                      the padding bytes may hold anything
+    *   const PackedB &b - packed k x n right operand
+    *   int32_t *c - m x b.n output, leading dimension ldc
+    */
+    void gemm (int m, const uint8_t *a, int lda, const PackedB &b, int32_t *c, int ldc);
+
+    // Name of the micro-kernel the library was built with
+    const char *kernel_name ();
+}
@@ -0,0 +1,117 @@
+#include "Random.hpp"
+#include "VecMath.hpp"
+#include "Parallel.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+
+
+namespace {
+
+    const uint64_t DEFAULT_SEED = 0x5eed5eed5eed5eedULL;
+
+    uint64_t initial_seed () {
+        if (const char *env = std::getenv("MATRIX_SEED"))
+            return std::strtoull(env, nullptr, 0);
+        return DEFAULT_SEED;
+    }
+
+    std::atomic<uint64_t> global_seed(initial_seed()), streams(0);
+
+    // sin and cos of 2 pi u for u in [0, 1]: u is split into a
+    // quadrant q and a rest |r| <= 1/8, so x = 2 pi r is within
+    // pi / 4 and degree 15 / 16 Taylor polynomials are accurate
+    // to double precision. The quadrant is applied with selects.
+    inline void sincos_2pi (double u, double &s, double &c) {
+        const double ROUND = 0x1.8p52; // rounds to nearest, std::floor would keep the loop scalar
+        double q = (u * 4.0 + ROUND) - ROUND;
+        double x = (u - q * 0.25) * 6.283185307179586476925;
+        double z = x * x;
+
+        double sp = 1.0 / 1307674368000;
+        sp = sp * z - 1.0 / 6227020800;
+        sp = sp * z + 1.0 / 39916800;
+        sp = sp * z - 1.0 / 362880;
+        sp = sp * z + 1.0 / 5040;
+        sp = sp * z - 1.0 / 120;
+        sp = sp * z + 1.0 / 6;
+        double sin_x = x - x * z * sp;
+
+        double cp = 1.0 / 20922789888000;
+        cp = cp * z - 1.0 / 87178291200;
+        cp = cp * z + 1.0 / 479001600;
+        cp = cp * z - 1.0 / 3628800;
+        cp = cp * z + 1.0 / 40320;
+        cp = cp * z - 1.0 / 720;
+        cp = cp * z + 1.0 / 24;
+        cp = cp * z - 0.5;
+        double cos_x = 1.0 + z * cp;
+
+        // q is 0..4, 4 is the same as 0; kept in double to stay vectorizable
+        bool odd = (q == 1.0 || q == 3.0);
+        double swap_s = odd ? cos_x : sin_x;
+        double swap_c = odd ? sin_x : cos_x;
+        s = (q == 2.0 || q == 3.0) ? -swap_s : swap_s;
+        c = (q == 1.0 || q == 2.0) ? -swap_c : swap_c;
+    }
+}
+
+
+void rng::set_seed (uint64_t seed) {
+    global_seed.store(seed, std::memory_order_relaxed);
+    streams.store(0, std::memory_order_relaxed);
+}
+
+uint64_t rng::seed () {
+    return global_seed.load(std::memory_order_relaxed);
+}
+
+uint64_t rng::next_stream () {
+    return streams.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <class T>
+void rng::normal (T *y, long n, uint64_t seed, uint64_t stream) {
+    long pairs = (n + 1) / 2;
+
+    exec::parallel_for(pairs, exec::RANDOM, [&](long begin, long end) {
+        const long TILE = 256;
+        double u1[TILE], u2[TILE], r[TILE];
+        for (long first = begin; first < end; first += TILE) {
+            long size = std::min(TILE, end - first);
+
+            // 53-bit uniforms, u1 in (0, 1) so its log is finite
+            for (long i = 0; i < size; i++) {
+                uint32_t bits[4];
+                rng::philox(seed, (uint64_t)(first + i), stream, bits);
+                uint64_t a = ((uint64_t)bits[0] << 32) | bits[1];
+                uint64_t b = ((uint64_t)bits[2] << 32) | bits[3];
+                u1[i] = ((double)(a >> 11) + 0.5) * 0x1p-53;
+                u2[i] = (double)(b >> 11) * 0x1p-53;
+            }
+
+            vmath::log(u1, r, size);
+            #pragma omp simd
+            for (long i = 0; i < size; i++) {
+                double s, c, radius = std::sqrt(-2.0 * r[i]);
+                sincos_2pi(u2[i], s, c);
+                u1[i] = radius * c;
+                u2[i] = radius * s;
+            }
+
+            for (long i = 0; i < size; i++) {
+                long index = 2 * (first + i);
+                y[index] = T(compute_t<T>(u1[i]));
+                if (index + 1 < n)
+                    y[index + 1] = T(compute_t<T>(u2[i]));
+            }
+        }
+    }, 2);
+}
+
+template void rng::normal<double> (double *, long, uint64_t, uint64_t);
+template void rng::normal<float> (float *, long, uint64_t, uint64_t);
+template void rng::normal<bfloat16> (bfloat16 *, long, uint64_t, uint64_t);
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+
+/***********************************************************
+ * rng - counter-based random numbers (Philox4x32-10), backs
+ * Matrix::fill_rand and the shuffling of the Trainer.
+ * --------------------------------------------------------
+ * A Philox block is a pure function of (key, counter): 10
+ * rounds of multiply/xor turn a 128-bit counter into 128
+ * random bits. Element i of a fill only depends on the seed,
+ * the stream and i, so fills run in parallel and the result is
+ * bit-identical for any thread count.
+ * --------------------------------------------------------
+ * Seeding:
+ *    -The global seed comes from MATRIX_SEED (a fixed default
+ *    otherwise), set_seed() changes it. Runs are reproducible
+ *    by default.
+ *    -Every Matrix::fill_rand() and every Philox engine built
+ *    without an explicit stream takes the next stream number,
+ *    so consecutive fills are independent, and set_seed()
+ *    starts the streams over.
+ **********************************************************/
+namespace rng {
+
+    void set_seed (uint64_t seed); //also restarts the stream numbers
+    uint64_t seed ();
+    uint64_t next_stream ();
+
+    // One Philox4x32-10 block: 4 random words for block `counter` of `stream`
+    inline void philox (uint64_t key, uint64_t counter, uint64_t stream, uint32_t out[4]) {
+        const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+        const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+        uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+        uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32);
+        uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = (uint64_t)M0 * c0, p1 = (uint64_t)M1 * c2;
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            c0 = n0; c1 = (uint32_t)p1; c2 = n2; c3 = (uint32_t)p0;
+            k0 += W0; k1 += W1;
+        }
+        out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+    }
+
+    /*
+    * Sequential engine over one Philox stream, meets the
+    * UniformRandomBitGenerator requirements (std::shuffle etc.).
+    */
+    class Philox {
+    private:
+        uint64_t key;
+        uint64_t stream;
+        uint64_t counter = 0;
+        uint32_t block[4];
+        int position = 4; //next unused word of block
+    public:
+        using result_type = uint32_t;
+        Philox () : Philox(rng::seed(), rng::next_stream()) {};
+        Philox (uint64_t seed, uint64_t stream) : key(seed), stream(stream) {};
+
+        static constexpr result_type min () { return 0; }
+        static constexpr result_type max () { return std::numeric_limits<uint32_t>::max(); }
+
+        // Position in the stream, enough to continue it elsewhere (checkpoints)
+        struct State {
+            uint64_t key;
+            uint64_t stream;
+            uint64_t counter;
+            int32_t position;
+        };
+        State state () const { return State{ this->key, this->stream, this->counter, this->position }; }
+        void restore (const State &state) {
+            this->key = state.key;
+            this->stream = state.stream;
+            this->counter = state.counter;
+            this->position = state.position;
+            // The unused words of the current block are recomputed
+            if (this->position < 4)
+                philox(this->key, this->counter - 1, this->stream, this->block);
+        }
+
+        result_type operator() () {
+            if (this->position == 4) {
+                philox(this->key, this->counter++, this->stream, this->block);
+                this->position = 0;
+            }
+            return this->block[this->position++];
+        }
+    };
+
+    /*
+    * Fills y with n standard normal numbers (Box-Muller over
+    * Philox blocks, one block per pair of elements). The polar
+    * angle uses a branch-free sin/cos and the log comes from
+    * vmath, so both loops vectorize.
+    */
+    template <class T>
+    void normal (T *y, long n, uint64_t seed, uint64_t stream);
+}
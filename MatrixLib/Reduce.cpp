@@ -0,0 +1,242 @@
+#include "Reduce.hpp"
+#include "Parallel.hpp"
+
+#include <limits>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+
+
+namespace {
+
+    // Columns of a block share one L1-resident vector of partials
+    const int COLUMN_BLOCK = 256;
+    // Sums are accumulated per block of rows first, so that a float
+    // sum over a tall column doesn't lose its low bits
+    const long ROW_BLOCK = 1024;
+
+    // Value (and index for ARGMAX) of a partial reduction, indices
+    // are exact ints whatever the element type
+    template <class C>
+    struct Partial {
+        C value;
+        int index;
+    };
+
+    // Largest index T holds exactly: 2^digits of its significand
+    template <class T>
+    long exact_indices () {
+        int digits = std::is_same<T, bfloat16>::value ? 8 : std::numeric_limits<T>::digits;
+        return 1L << std::min(digits, 62);
+    }
+
+    template <class C>
+    inline C identity (reduce::Op op) {
+        return (op == reduce::SUM || op == reduce::MEAN) ? C(0) : -std::numeric_limits<C>::infinity();
+    }
+
+    // Combines partials of consecutive ranges, a comes first, so
+    // ties keep the earlier index
+    template <class C>
+    inline Partial<C> combine (reduce::Op op, Partial<C> a, Partial<C> b) {
+        if (op == reduce::SUM || op == reduce::MEAN)
+            return Partial<C>{ a.value + b.value, 0 };
+        return (b.value > a.value) ? b : a;
+    }
+
+    // Reduces x[begin, end) of one row
+    template <class T, class C>
+    Partial<C> reduce_row (reduce::Op op, const T *x, long begin, long end) {
+        if (op == reduce::SUM || op == reduce::MEAN) {
+            C sum = 0;
+            #pragma omp simd reduction(+: sum)
+            for (long j = begin; j < end; j++)
+                sum += C(x[j]);
+            return Partial<C>{ sum, 0 };
+        }
+        if (op == reduce::MAX) {
+            C max = identity<C>(op);
+            #pragma omp simd reduction(max: max)
+            for (long j = begin; j < end; j++)
+                max = std::max(max, C(x[j]));
+            return Partial<C>{ max, 0 };
+        }
+
+        // ARGMAX: every lane tracks the max of its own residue class,
+        // the lanes are merged at the end
+        const int LANES = 16;
+        C best[LANES];
+        int index[LANES], position[LANES];
+        for (int l = 0; l < LANES; l++) {
+            best[l] = identity<C>(op);
+            index[l] = (int)begin;
+            position[l] = (int)begin + l;
+        }
+        long j = begin;
+        for (; j + LANES <= end; j += LANES) {
+            #pragma omp simd
+            for (int l = 0; l < LANES; l++) {
+                C v = C(x[j + l]);
+                bool greater = v > best[l];
+                best[l] = greater ? v : best[l];
+                index[l] = greater ? position[l] : index[l];
+                position[l] += LANES;
+            }
+        }
+        Partial<C> result{ identity<C>(op), (int)begin };
+        for (int l = 0; l < LANES; l++) {
+            if (best[l] > result.value || (best[l] == result.value && index[l] < result.index))
+                result = Partial<C>{ best[l], index[l] };
+        }
+        for (; j < end; j++) {
+            if (C(x[j]) > result.value)
+                result = Partial<C>{ C(x[j]), (int)j };
+        }
+        return result;
+    }
+
+    // Reduces rows [row_begin, row_end) of columns [col_begin, col_end)
+    // into value and index (at most COLUMN_BLOCK entries), row by row
+    template <class T, class C>
+    void reduce_columns (reduce::Op op, const T *x, int cols, long row_begin, long row_end,
+                         int col_begin, int col_end, C *value, int *index) {
+        int width = col_end - col_begin;
+        for (int j = 0; j < width; j++) {
+            value[j] = identity<C>(op);
+            index[j] = (int)row_begin;
+        }
+        if (op == reduce::SUM || op == reduce::MEAN) {
+            C block[COLUMN_BLOCK];
+            for (long r0 = row_begin; r0 < row_end; r0 += ROW_BLOCK) {
+                long r1 = std::min(row_end, r0 + ROW_BLOCK);
+                std::fill(block, block + width, C(0));
+                for (long i = r0; i < r1; i++) {
+                    const T *row = x + i * cols + col_begin;
+                    #pragma omp simd
+                    for (int j = 0; j < width; j++)
+                        block[j] += C(row[j]);
+                }
+                #pragma omp simd
+                for (int j = 0; j < width; j++)
+                    value[j] += block[j];
+            }
+            return;
+        }
+        for (long i = row_begin; i < row_end; i++) {
+            const T *row = x + i * cols + col_begin;
+            if (op == reduce::MAX) {
+                #pragma omp simd
+                for (int j = 0; j < width; j++)
+                    value[j] = std::max(value[j], C(row[j]));
+            } else {
+                int position = (int)i;
+                #pragma omp simd
+                for (int j = 0; j < width; j++) {
+                    C v = C(row[j]);
+                    bool greater = v > value[j];
+                    value[j] = greater ? v : value[j];
+                    index[j] = greater ? position : index[j];
+                }
+            }
+        }
+    }
+
+    template <class T, class C>
+    inline T result (reduce::Op op, Partial<C> p, long count) {
+        if (op == reduce::MEAN)
+            return T(p.value / C(count));
+        return op == reduce::ARGMAX ? T(C(p.index)) : T(p.value);
+    }
+
+    template <class T>
+    void along_rows (reduce::Op op, const T *x, int rows, int cols, T *out) {
+        using C = compute_t<T>;
+        int threads = exec::threads((long)rows * cols, exec::REDUCTION);
+
+        if (threads > rows) {
+            // Few long rows: every row is split between the threads
+            for (int i = 0; i < rows; i++) {
+                const T *row = x + (long)i * cols;
+                Partial<C> p = exec::parallel_reduce((long)cols, exec::REDUCTION, Partial<C>{ identity<C>(op), 0 },
+                    [&](long begin, long end) { return reduce_row<T, C>(op, row, begin, end); },
+                    [&](Partial<C> a, Partial<C> b) { return combine(op, a, b); });
+                out[i] = result<T, C>(op, p, cols);
+            }
+            return;
+        }
+
+        exec::parallel_for(rows, exec::REDUCTION, [&](long begin, long end) {
+            for (long i = begin; i < end; i++)
+                out[i] = result<T, C>(op, reduce_row<T, C>(op, x + i * cols, 0, cols), cols);
+        }, cols);
+    }
+
+    template <class T>
+    void along_cols (reduce::Op op, const T *x, int rows, int cols, T *out) {
+        using C = compute_t<T>;
+        const int BLOCK = COLUMN_BLOCK;
+        int blocks = (cols + BLOCK - 1) / BLOCK;
+        int threads = exec::threads((long)rows * cols, exec::REDUCTION);
+
+        if (threads > blocks) {
+            // Few columns: the rows are split into chunks, one per thread, whose
+            // partials go to a per-thread scratch and are combined in row order
+            int count = (int)std::min<long>(threads, rows);
+            static thread_local std::vector<Partial<C>> scratch;
+            if (scratch.size() < (size_t)count * cols)
+                scratch.resize((size_t)count * cols);
+            Partial<C> *partials = scratch.data();
+            exec::parallel_for(count, exec::REDUCTION, [&](long first, long last) {
+                C value[BLOCK];
+                int index[BLOCK];
+                for (long id = first; id < last; id++) {
+                    auto range = exec::chunk(rows, (int)id, count);
+                    Partial<C> *partial = partials + id * cols;
+                    for (int c0 = 0; c0 < cols; c0 += BLOCK) {
+                        int c1 = std::min(cols, c0 + BLOCK);
+                        reduce_columns<T, C>(op, x, cols, range.first, range.second, c0, c1, value, index);
+                        for (int j = c0; j < c1; j++)
+                            partial[j] = Partial<C>{ value[j - c0], index[j - c0] };
+                    }
+                }
+            }, (long)rows / count * cols);
+            for (int j = 0; j < cols; j++) {
+                Partial<C> total = partials[j];
+                for (int id = 1; id < count; id++)
+                    total = combine(op, total, partials[(long)id * cols + j]);
+                out[j] = result<T, C>(op, total, rows);
+            }
+            return;
+        }
+
+        exec::parallel_for(blocks, exec::REDUCTION, [&](long begin, long end) {
+            C value[BLOCK];
+            int index[BLOCK];
+            for (long b = begin; b < end; b++) {
+                int c0 = b * BLOCK, c1 = std::min(cols, c0 + BLOCK);
+                reduce_columns<T, C>(op, x, cols, 0, rows, c0, c1, value, index);
+                for (int j = c0; j < c1; j++)
+                    out[j] = result<T, C>(op, Partial<C>{ value[j - c0], index[j - c0] }, rows);
+            }
+        }, (long)rows * BLOCK);
+    }
+}
+
+
+template <class T>
+void reduce::reduce (Op op, int axis, const T *x, int rows, int cols, T *out) {
+    long length = axis == 0 ? rows : cols;
+    if (op == ARGMAX && length - 1 > exact_indices<T>())
+        throw std::runtime_error("Error: Argmax over " + std::to_string(length)
+                                 + " elements, its indices aren't exact in this element type!\n");
+    if (axis == 0)
+        along_cols(op, x, rows, cols, out);
+    else
+        along_rows(op, x, rows, cols, out);
+}
+
+template void reduce::reduce<double> (Op, int, const double *, int, int, double *);
+template void reduce::reduce<float> (Op, int, const float *, int, int, float *);
+template void reduce::reduce<bfloat16> (Op, int, const bfloat16 *, int, int, bfloat16 *);
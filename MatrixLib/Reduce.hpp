@@ -0,0 +1,45 @@
+#pragma once
+#include "BFloat16.hpp"
+
+/***********************************************************
+ * reduce - single pass reductions over row-major buffers,
+ * backs Matrix::sum, mean, max and argmax along both axes.
+ * --------------------------------------------------------
+ * Axis 1 (one result per row) reads every row contiguously
+ * with SIMD horizontal reductions. Axis 0 (one result per
+ * column) never walks a column with stride: a block of
+ * columns is accumulated row by row into a vector of partials
+ * that stays in L1. Rows or columns are split between threads
+ * by the exec policy; when there are fewer of them than
+ * threads (a 1 x n row, a n x 1 column), ranges of the other
+ * dimension are reduced separately and combined in order.
+ * --------------------------------------------------------
+ * Notes:
+ *    -ARGMAX finds value and index in the same pass and
+ *    returns the first index of the maximum, like numpy. The
+ *    indices are tracked as ints and stored as T, which holds
+ *    them exactly up to 2^24 for float and only up to 256 for
+ *    bfloat16: a longer argmax throws.
+ *    -Values are accumulated in compute_t<T>.
+ *    -NaNs are ignored by MAX and ARGMAX.
+ **********************************************************/
+namespace reduce {
+
+    enum Op {
+        SUM,
+        MEAN,
+        MAX,
+        ARGMAX
+    };
+
+    /*
+    * Parameters:
+    *   Op op - reduction
+    *   int axis - 0: out gets one value per column (1 x cols),
+    *              1: out gets one value per row (rows x 1)
+    *   const T *x - rows x cols row-major input
+    *   T *out - output, indices of ARGMAX are stored as T (see above)
+    */
+    template <class T>
+    void reduce (Op op, int axis, const T *x, int rows, int cols, T *out);
+}
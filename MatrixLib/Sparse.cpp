@@ -0,0 +1,228 @@
+#include "Sparse.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <type_traits>
+#include <stdexcept>
+
+
+template <class DType>
+BasicSparseMatrix<DType>::BasicSparseMatrix (int rows, int cols) {
+    this->row_size = rows;
+    this->col_size = cols;
+    this->row_start.assign(rows + 1, 0);
+}
+
+template <class DType>
+BasicSparseMatrix<DType>::BasicSparseMatrix (const BasicMatrix<DType> &mtx) {
+    std::tie(this->row_size, this->col_size) = mtx.shape();
+    int rows = this->row_size, cols = this->col_size;
+    const DType *src = mtx.data();
+
+    // Count the non-zeros of every row, then fill the rows in parallel
+    this->row_start.assign(rows + 1, 0);
+    int *start = this->row_start.data();
+    exec::parallel_for(rows, exec::COPY, [&](long begin, long end) {
+        for (long i = begin; i < end; i++) {
+            const DType *row = src + i * cols;
+            int count = 0;
+            #pragma omp simd reduction(+: count)
+            for (int j = 0; j < cols; j++)
+                count += (compute_type(row[j]) != compute_type(0));
+            start[i + 1] = count;
+        }
+    }, cols);
+    for (int i = 0; i < rows; i++)
+        start[i + 1] += start[i];
+
+    this->column.resize(start[rows]);
+    this->values.resize(start[rows]);
+    int *col = this->column.data();
+    DType *val = this->values.data();
+    exec::parallel_for(rows, exec::COPY, [&](long begin, long end) {
+        // Branch-free compaction: every element is stored and the
+        // position only moves on non-zeros. It runs into a scratch row,
+        // stores past the last non-zero would hit the next row.
+        vector<int, workspace::Allocator<int>> col_row(cols + 1);
+        vector<DType, workspace::Allocator<DType>> val_row(cols + 1);
+        for (long i = begin; i < end; i++) {
+            const DType *row = src + i * cols;
+            int k = 0;
+            for (int j = 0; j < cols; j++) {
+                col_row[k] = j;
+                val_row[k] = row[j];
+                k += (compute_type(row[j]) != compute_type(0));
+            }
+            std::copy(col_row.begin(), col_row.begin() + k, col + start[i]);
+            std::copy(val_row.begin(), val_row.begin() + k, val + start[i]);
+        }
+    }, cols);
+}
+
+template <class DType>
+BasicMatrix<DType> BasicSparseMatrix<DType>::dense () const {
+    BasicMatrix<DType> result(this->row_size, this->col_size);
+    result.fill_zeros();
+    DType *dst = result.data();
+    exec::parallel_for(this->row_size, exec::COPY, [&](long begin, long end) {
+        for (long i = begin; i < end; i++)
+            for (int k = this->row_start[i]; k < this->row_start[i + 1]; k++)
+                dst[i * this->col_size + this->column[k]] = this->values[k];
+    }, std::max(1L, this->nnz() / std::max(1, this->row_size)));
+    return result;
+}
+
+// CSR of the transpose by counting sort over the columns, rows are
+// visited in order, so the columns of the result stay sorted
+template <class DType>
+BasicSparseMatrix<DType> BasicSparseMatrix<DType>::T () const {
+    BasicSparseMatrix result(this->col_size, this->row_size);
+    long nnz = this->nnz();
+    result.column.resize(nnz);
+    result.values.resize(nnz);
+
+    int *start = result.row_start.data();
+    for (long k = 0; k < nnz; k++)
+        start[this->column[k] + 1]++;
+    for (int j = 0; j < this->col_size; j++)
+        start[j + 1] += start[j];
+
+    vector<int, workspace::Allocator<int>> next(start, start + this->col_size);
+    for (int i = 0; i < this->row_size; i++) {
+        for (int k = this->row_start[i]; k < this->row_start[i + 1]; k++) {
+            int position = next[this->column[k]]++;
+            result.column[position] = i;
+            result.values[position] = this->values[k];
+        }
+    }
+    return result;
+}
+
+template <class DType>
+double BasicSparseMatrix<DType>::density () const {
+    double size = (double)this->row_size * this->col_size;
+    return size > 0 ? this->nnz() / size : 0.0;
+}
+
+template <class DType>
+double BasicSparseMatrix<DType>::density (const BasicMatrix<DType> &mtx) {
+    long size = (long)std::get<0>(mtx.shape()) * std::get<1>(mtx.shape());
+    const DType *src = mtx.data();
+    long count = exec::parallel_reduce(size, exec::REDUCTION, 0L, [&](long begin, long end) {
+        long count = 0;
+        #pragma omp simd reduction(+: count)
+        for (long i = begin; i < end; i++)
+            count += (compute_type(src[i]) != compute_type(0));
+        return count;
+    }, [](long a, long b) { return a + b; });
+    return size > 0 ? (double)count / size : 0.0;
+}
+
+template <class DType>
+void BasicSparseMatrix<DType>::spmm (compute_type alpha, const BasicSparseMatrix &A, bool trans_a,
+                                     const BasicMatrix<DType> &B, compute_type beta, BasicMatrix<DType> &C) {
+    if (trans_a) {
+        int m = A.col_size, n = std::get<1>(B.shape());
+        long cost = std::max(1L, A.nnz() / std::max(1, m)) * n;
+        if (std::is_same<DType, compute_type>::value && exec::threads(cost * m, exec::ELEMENTWISE) <= 1) {
+            spmm_scatter(alpha, A, B, beta, C);
+            return;
+        }
+        spmm(alpha, A.T(), false, B, beta, C);
+        return;
+    }
+
+    int m = A.row_size, k = A.col_size;
+    int k_b = std::get<0>(B.shape()), n = std::get<1>(B.shape());
+    if (k != k_b) {
+        throw std::runtime_error("Matrices aren't compatible!");
+    }
+    if (C.shape() != std::make_tuple(m, n)) {
+        if (beta != compute_type(0))
+            throw std::runtime_error("Output matrix has incompatible shape!");
+        C = BasicMatrix<DType>(m, n);
+    }
+
+    const int *start = A.row_start.data();
+    const int *col = A.column.data();
+    const DType *val = A.values.data();
+    const DType *b = B.data();
+    DType *c = C.data();
+    long row_cost = std::max(1L, A.nnz() / std::max(1, m)) * n;
+
+    exec::parallel_for(m, exec::ELEMENTWISE, [&](long begin, long end) {
+        compute_type acc[COLUMN_BLOCK];
+        for (long i = begin; i < end; i++) {
+            DType *c_row = c + i * n;
+            for (int j0 = 0; j0 < n; j0 += COLUMN_BLOCK) {
+                int width = std::min(COLUMN_BLOCK, n - j0);
+                if (beta == compute_type(0)) {
+                    std::fill(acc, acc + width, compute_type(0));
+                } else {
+                    #pragma omp simd
+                    for (int j = 0; j < width; j++)
+                        acc[j] = beta * compute_type(c_row[j0 + j]);
+                }
+                for (int p = start[i]; p < start[i + 1]; p++) {
+                    compute_type a = alpha * compute_type(val[p]);
+                    const DType *b_row = b + (long)col[p] * n + j0;
+                    #pragma omp simd
+                    for (int j = 0; j < width; j++)
+                        acc[j] += a * compute_type(b_row[j]);
+                }
+                for (int j = 0; j < width; j++)
+                    c_row[j0 + j] = DType(acc[j]);
+            }
+        }
+    }, row_cost);
+}
+
+// C = alpha * A^T x B + beta * C without transposing A: row i of A
+// scatters B's row i into the output rows of its columns. Serial,
+// and only for types that are their own compute type.
+template <class DType>
+void BasicSparseMatrix<DType>::spmm_scatter (compute_type alpha, const BasicSparseMatrix &A,
+                                             const BasicMatrix<DType> &B, compute_type beta, BasicMatrix<DType> &C) {
+    int m = A.col_size, k = A.row_size;
+    int k_b = std::get<0>(B.shape()), n = std::get<1>(B.shape());
+    if (k != k_b) {
+        throw std::runtime_error("Matrices aren't compatible!");
+    }
+    if (C.shape() != std::make_tuple(m, n)) {
+        if (beta != compute_type(0))
+            throw std::runtime_error("Output matrix has incompatible shape!");
+        C = BasicMatrix<DType>(m, n);
+    }
+
+    DType *c = C.data();
+    const DType *b = B.data();
+    long size = (long)m * n;
+    if (beta == compute_type(0)) {
+        std::fill(c, c + size, DType(0));
+    } else if (beta != compute_type(1)) {
+        #pragma omp simd
+        for (long i = 0; i < size; i++)
+            c[i] = DType(beta * compute_type(c[i]));
+    }
+    for (int i = 0; i < k; i++) {
+        const DType *b_row = b + (long)i * n;
+        for (int p = A.row_start[i]; p < A.row_start[i + 1]; p++) {
+            compute_type a = alpha * compute_type(A.values[p]);
+            DType *c_row = c + (long)A.column[p] * n;
+            #pragma omp simd
+            for (int j = 0; j < n; j++)
+                c_row[j] = DType(compute_type(c_row[j]) + a * compute_type(b_row[j]));
+        }
+    }
+}
+
+template <class DType>
+BasicMatrix<DType> BasicSparseMatrix<DType>::dot (const BasicMatrix<DType> &mtx, bool trans_this) const {
+    BasicMatrix<DType> product;
+    spmm(compute_type(1), (*this), trans_this, mtx, compute_type(0), product);
+    return product;
+}
+
+template class BasicSparseMatrix<double>;
+template class BasicSparseMatrix<float>;
+template class BasicSparseMatrix<bfloat16>;
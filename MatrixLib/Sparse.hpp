@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <tuple>
+#include "Matrix.hpp"
+
+/***********************************************************
+ * Class BasicSparseMatrix is a CSR (compressed sparse row)
+ * matrix, made from a dense BasicMatrix by dropping its zeros.
+ * It backs the sparse path of FCLayer: after a ReLU a large
+ * share of the activations are exactly zero, and a product
+ * with a sparse left operand only costs its non-zeros.
+ * --------------------------------------------------------
+ * Layout: the non-zeros of row i are values[k] at column
+ * column[k] for k in [row_start[i], row_start[i + 1]), sorted
+ * by column. Storage comes from the workspace pool.
+ * --------------------------------------------------------
+ * Products (spmm):
+ *    -A x B runs over the rows of A, every non-zero adds a
+ *    scaled row of B to the output row, which is accumulated
+ *    in compute_t<DType> over blocks of COLUMN_BLOCK columns.
+ *    -A^T x B first transposes A in CSR (one counting pass
+ *    over the non-zeros) and runs the same kernel, so that
+ *    output rows are never written by two threads. A serial
+ *    product skips the transpose and scatters rows of B
+ *    into the output instead.
+ * Rows are split between threads by the exec policy, with
+ * the number of non-zeros as the cost.
+ * --------------------------------------------------------
+ * There is no block-sparse (BSR) variant: the zeros after a
+ * ReLU are unstructured, 4x1 blocks of the model's hidden
+ * activations are 25-65% filled at 7-21% density, and an A^T x B
+ * over them measured about 2x slower than the plain CSR one.
+ **********************************************************/
+template <class DType>
+class BasicSparseMatrix {
+private:
+    int row_size;
+    int col_size;
+    vector<int, workspace::Allocator<int>> row_start; //row_size + 1 offsets into column and values
+    vector<int, workspace::Allocator<int>> column;
+    vector<DType, workspace::Allocator<DType>> values;
+
+public:
+    using compute_type = compute_t<DType>;
+    static const int COLUMN_BLOCK = 256; //output columns accumulated at once
+
+    BasicSparseMatrix () : BasicSparseMatrix(0, 0) {};
+    BasicSparseMatrix (int, int); //all zeros
+    explicit BasicSparseMatrix (const BasicMatrix<DType> &);
+    BasicMatrix<DType> dense () const;
+    BasicSparseMatrix T () const;
+    tuple<int, int> shape () const { return tuple<int, int>(this->row_size, this->col_size); };
+    long nnz () const { return this->row_start.back(); };
+    double density () const;
+    static double density (const BasicMatrix<DType> &); //share of non-zeros in a dense matrix
+    /*
+    * BLAS-like C = alpha * op(A) x B + beta * C, op(A) is A or A^T.
+    * With beta == 0 C is resized to the product shape if needed
+    * and never read, as in BasicMatrix::gemm.
+    */
+    static void spmm (compute_type, const BasicSparseMatrix &, bool, const BasicMatrix<DType> &,
+                      compute_type, BasicMatrix<DType> &);
+    BasicMatrix<DType> dot (const BasicMatrix<DType> &, bool = false) const;
+
+private:
+    static void spmm_scatter (compute_type, const BasicSparseMatrix &, const BasicMatrix<DType> &,
+                              compute_type, BasicMatrix<DType> &); //serial A^T x B
+};
+
+using SparseMatrix = BasicSparseMatrix<double>;
+using SparseMatrixF = BasicSparseMatrix<float>;
@@ -0,0 +1,269 @@
+#include "VecMath.hpp"
+#include "Parallel.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+
+namespace {
+
+    inline uint64_t to_bits (double x) { uint64_t u; std::memcpy(&u, &x, sizeof(u)); return u; }
+    inline double from_bits (uint64_t u) { double x; std::memcpy(&x, &u, sizeof(x)); return x; }
+    inline uint32_t to_bits (float x) { uint32_t u; std::memcpy(&u, &x, sizeof(u)); return u; }
+    inline float from_bits (uint32_t u) { float x; std::memcpy(&x, &u, sizeof(x)); return x; }
+
+    // std::fma is a library call unless the target has FMA instructions
+    template <class C>
+    inline C mul_add (C a, C b, C c) {
+#ifdef __FMA__
+        return std::fma(a, b, c);
+#else
+        return a * b + c;
+#endif
+    }
+
+    // exp(x) = 2^n * exp(r), where n = round(x / ln2) and |r| <= ln2 / 2.
+    // exp(r) is a degree 13 (double) or 7 (float) Taylor polynomial, 2^n
+    // is built from exponent bits in two halves, so that results in the
+    // subnormal range and overflows to inf come out of the multiplication.
+    inline double exp_kernel (double x) {
+        const double ROUND = 0x1.8p52; // adding it rounds to an integer kept in the low bits
+        const double LN2_HI = 0x1.62e42fefa39efp-1, LN2_LO = 0x1.abc9e3b39803fp-56;
+
+        double xc = std::min(std::max(x, -746.0), 710.0); // NaN passes through
+        double t = xc * 0x1.71547652b82fep0 + ROUND;
+        double n = t - ROUND;
+        int64_t ni = (int64_t)(to_bits(t) - to_bits(ROUND));
+        double r = mul_add(n, -LN2_HI, xc);
+        r = mul_add(n, -LN2_LO, r);
+
+        // Horner's scheme is spelled out, loops in here would keep the callers from vectorizing
+        double p = mul_add(1.0 / 6227020800, r, 1.0 / 479001600);
+        p = mul_add(p, r, 1.0 / 39916800);
+        p = mul_add(p, r, 1.0 / 3628800);
+        p = mul_add(p, r, 1.0 / 362880);
+        p = mul_add(p, r, 1.0 / 40320);
+        p = mul_add(p, r, 1.0 / 5040);
+        p = mul_add(p, r, 1.0 / 720);
+        p = mul_add(p, r, 1.0 / 120);
+        p = mul_add(p, r, 1.0 / 24);
+        p = mul_add(p, r, 1.0 / 6);
+        p = mul_add(p, r, 0.5);
+        p = mul_add(p, r, 1.0);
+        p = mul_add(p, r, 1.0);
+
+        int64_t n1 = (int64_t)((uint64_t)(ni + 2048) >> 1) - 1024;
+        int64_t n2 = ni - n1;
+        return p * from_bits((uint64_t)(n1 + 1023) << 52) * from_bits((uint64_t)(n2 + 1023) << 52);
+    }
+
+    inline float exp_kernel (float x) {
+        const float ROUND = 0x1.8p23f;
+        const float LN2_HI = 0x1.62e43p-1f, LN2_LO = -0x1.05c610p-29f;
+
+        float xc = std::min(std::max(x, -104.0f), 89.0f);
+        float t = xc * 0x1.715476p0f + ROUND;
+        float n = t - ROUND;
+        int32_t ni = (int32_t)(to_bits(t) - to_bits(ROUND));
+        float r = mul_add(n, -LN2_HI, xc);
+        r = mul_add(n, -LN2_LO, r);
+
+        float p = mul_add(1.0f / 5040, r, 1.0f / 720);
+        p = mul_add(p, r, 1.0f / 120);
+        p = mul_add(p, r, 1.0f / 24);
+        p = mul_add(p, r, 1.0f / 6);
+        p = mul_add(p, r, 0.5f);
+        p = mul_add(p, r, 1.0f);
+        p = mul_add(p, r, 1.0f);
+
+        int32_t n1 = (int32_t)((uint32_t)(ni + 256) >> 1) - 128;
+        int32_t n2 = ni - n1;
+        return p * from_bits((uint32_t)(n1 + 127) << 23) * from_bits((uint32_t)(n2 + 127) << 23);
+    }
+
+    // log(x) = e * ln2 + log(m), where x = m * 2^e and m is in
+    // [sqrt(2) / 2, sqrt(2)). With f = m - 1 and s = f / (2 + f),
+    // log(m) = 2 atanh(s) = 2s + 2s^3 / 3 + 2s^5 / 5 + ..., |s| < 0.172.
+    // Subnormals are scaled up by 2^52 (2^23) first.
+    inline double log_kernel (double x) {
+        const double LN2_HI = 0x1.62e42feep-1, LN2_LO = 0x1.a39ef35793c76p-33; // e * LN2_HI is exact
+        const uint64_t SQRT_HALF = 0x3fe6a09e667f3bcd;
+
+        bool tiny = x < 0x1p-1022;
+        double xs = tiny ? x * 0x1p52 : x;
+        uint64_t hx = to_bits(xs) + (0x3ff0000000000000 - SQRT_HALF);
+        double e = from_bits((hx >> 52) | 0x4330000000000000) - (0x1p52 + 1023) - (tiny ? 52.0 : 0.0);
+        double m = from_bits((hx & 0x000fffffffffffff) + SQRT_HALF);
+
+        double f = m - 1.0;
+        double s = f / (2.0 + f);
+        double z = s * s;
+        double q = mul_add(2.0 / 23, z, 2.0 / 21);
+        q = mul_add(q, z, 2.0 / 19);
+        q = mul_add(q, z, 2.0 / 17);
+        q = mul_add(q, z, 2.0 / 15);
+        q = mul_add(q, z, 2.0 / 13);
+        q = mul_add(q, z, 2.0 / 11);
+        q = mul_add(q, z, 2.0 / 9);
+        q = mul_add(q, z, 2.0 / 7);
+        q = mul_add(q, z, 2.0 / 5);
+        q = mul_add(q, z, 2.0 / 3);
+        double hfsq = 0.5 * f * f; // log(m) = f - hfsq + s * (hfsq + z * q) keeps the low bits of f
+        double lm = f - (hfsq - s * (hfsq + z * q));
+        double result = mul_add(e, LN2_HI, mul_add(e, LN2_LO, lm));
+
+        result = (x == INFINITY) ? x : result;
+        result = (x == 0.0) ? -INFINITY : result;
+        return (x >= 0.0) ? result : NAN;
+    }
+
+    inline float log_kernel (float x) {
+        const float LN2_HI = 0x1.62e4p-1f, LN2_LO = 0x1.7f7d1cp-20f;
+        const uint32_t SQRT_HALF = 0x3f3504f3;
+
+        bool tiny = x < 0x1p-126f;
+        float xs = tiny ? x * 0x1p23f : x;
+        uint32_t hx = to_bits(xs) + (0x3f800000 - SQRT_HALF);
+        float e = from_bits((hx >> 23) | 0x4b000000u) - (0x1p23f + 127) - (tiny ? 23.0f : 0.0f);
+        float m = from_bits((hx & 0x007fffff) + SQRT_HALF);
+
+        float f = m - 1.0f;
+        float s = f / (2.0f + f);
+        float z = s * s;
+        float q = mul_add(2.0f / 11, z, 2.0f / 9);
+        q = mul_add(q, z, 2.0f / 7);
+        q = mul_add(q, z, 2.0f / 5);
+        q = mul_add(q, z, 2.0f / 3);
+        float hfsq = 0.5f * f * f;
+        float lm = f - (hfsq - s * (hfsq + z * q));
+        float result = mul_add(e, LN2_HI, mul_add(e, LN2_LO, lm));
+
+        result = (x == INFINITY) ? x : result;
+        result = (x == 0.0f) ? -INFINITY : result;
+        return (x >= 0.0f) ? result : NAN;
+    }
+}
+
+
+template <class T>
+void vmath::exp (const T *x, T *y, long n) {
+    using C = compute_t<T>;
+    exec::parallel_for(n, exec::TRANSCENDENTAL, [&](long begin, long end) {
+        #pragma omp simd
+        for (long i = begin; i < end; i++)
+            y[i] = T(exp_kernel(C(x[i])));
+    });
+}
+
+template <class T>
+void vmath::log (const T *x, T *y, long n) {
+    using C = compute_t<T>;
+    exec::parallel_for(n, exec::TRANSCENDENTAL, [&](long begin, long end) {
+        #pragma omp simd
+        for (long i = begin; i < end; i++)
+            y[i] = T(log_kernel(C(x[i])));
+    });
+}
+
+template <class T>
+void vmath::sqrt (const T *x, T *y, long n) {
+    using C = compute_t<T>;
+    exec::parallel_for(n, exec::ELEMENTWISE, [&](long begin, long end) {
+        #pragma omp simd
+        for (long i = begin; i < end; i++)
+            y[i] = T(std::sqrt(C(x[i])));
+    });
+}
+
+template <class T>
+void vmath::pow (const T *x, T *y, long n, double deg) {
+    using C = compute_t<T>;
+    if (deg == 0.5) {
+        // sqrt with the special values of pow: sqrt(-0) is -0 where pow(-0, 0.5)
+        // is +0 (adding +0 fixes it) and pow(-inf, 0.5) is +inf where sqrt is NaN
+        const C inf = std::numeric_limits<C>::infinity();
+        exec::parallel_for(n, exec::ELEMENTWISE, [&](long begin, long end) {
+            #pragma omp simd
+            for (long i = begin; i < end; i++) {
+                C v = C(x[i]);
+                C r = std::sqrt(v) + C(0);
+                y[i] = T(v == -inf ? inf : r);
+            }
+        });
+        return;
+    }
+    if (deg == 2.0) {
+        // Squares (the L2 term) are a single pass
+        exec::parallel_for(n, exec::ELEMENTWISE, [&](long begin, long end) {
+            #pragma omp simd
+            for (long i = begin; i < end; i++)
+                y[i] = T(C(x[i]) * C(x[i]));
+        });
+        return;
+    }
+
+    if (deg == std::floor(deg) && std::fabs(deg) <= 1024) {
+        // Repeated squaring, run a bit of the exponent at a time over
+        // blocks of elements, so that every pass is a plain vector loop
+        const long BLOCK = 256;
+        long k = (long)std::fabs(deg);
+        long blocks = (n + BLOCK - 1) / BLOCK;
+
+        // Every block costs about one multiplication per squaring
+        long cost = 0;
+        for (long e = k; e > 0; e >>= 1)
+            cost++;
+
+        exec::parallel_for(blocks, exec::ELEMENTWISE, [&](long block_begin, long block_end) {
+            for (long b = block_begin; b < block_end; b++) {
+                long first = b * BLOCK, size = std::min(BLOCK, n - first);
+                C base[BLOCK], acc[BLOCK];
+                for (long i = 0; i < size; i++) {
+                    base[i] = C(x[first + i]);
+                    acc[i] = C(1);
+                }
+                for (long e = k; e > 0; e >>= 1) {
+                    if (e & 1) {
+                        #pragma omp simd
+                        for (long i = 0; i < size; i++)
+                            acc[i] *= base[i];
+                    }
+                    if (e > 1) {
+                        #pragma omp simd
+                        for (long i = 0; i < size; i++)
+                            base[i] *= base[i];
+                    }
+                }
+                if (deg < 0) {
+                    #pragma omp simd
+                    for (long i = 0; i < size; i++)
+                        acc[i] = C(1) / acc[i];
+                }
+                for (long i = 0; i < size; i++)
+                    y[first + i] = T(acc[i]);
+            }
+        }, BLOCK * std::max(cost, 1L));
+        return;
+    }
+
+    exec::parallel_for(n, exec::TRANSCENDENTAL, [&](long begin, long end) {
+        for (long i = begin; i < end; i++)
+            y[i] = T(std::pow(C(x[i]), C(deg)));
+    });
+}
+
+template void vmath::exp<double> (const double *, double *, long);
+template void vmath::exp<float> (const float *, float *, long);
+template void vmath::exp<bfloat16> (const bfloat16 *, bfloat16 *, long);
+template void vmath::log<double> (const double *, double *, long);
+template void vmath::log<float> (const float *, float *, long);
+template void vmath::log<bfloat16> (const bfloat16 *, bfloat16 *, long);
+template void vmath::sqrt<double> (const double *, double *, long);
+template void vmath::sqrt<float> (const float *, float *, long);
+template void vmath::sqrt<bfloat16> (const bfloat16 *, bfloat16 *, long);
+template void vmath::pow<double> (const double *, double *, long, double);
+template void vmath::pow<float> (const float *, float *, long, double);
+template void vmath::pow<bfloat16> (const bfloat16 *, bfloat16 *, long, double);
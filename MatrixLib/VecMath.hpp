@@ -0,0 +1,42 @@
+#pragma once
+#include "BFloat16.hpp"
+
+/***********************************************************
+ * vmath - vectorized elementwise math over arrays, backs
+ * Matrix::exp, log, sqrt and operator ^. y may be equal to x.
+ * --------------------------------------------------------
+ * The kernels are written branch-free (bit tricks, selects
+ * instead of branches) so the compiler turns their loops into
+ * AVX2 or AVX-512 code, whatever -march allows. The library
+ * has to be built with -fno-math-errno for sqrt to vectorize.
+ * Elements are computed in compute_t<T>.
+ * --------------------------------------------------------
+ * Accuracy, max error vs. the exact result as measured by
+ * Benchmark/MathBench.cpp (make bench):
+ *    -exp: < 1 ULP for double and float. Results in the
+ *    subnormal range may lose one more bit.
+ *    -log: < 1.5 ULP for double, < 1 ULP for float.
+ *    -sqrt: correctly rounded (0.5 ULP).
+ *    -pow: deg = 2 is x * x (0.5 ULP) and deg = 0.5 is sqrt
+ *    (with pow's +0 for -0 and +inf for -inf).
+ *    Other integer exponents (|deg| <= 1024) are computed by
+ *    repeated squaring, each multiplication adds up to 0.5 ULP
+ *    (about 4.5 ULP for deg = 7). Any other exponent calls
+ *    std::pow per element (not vectorized).
+ * Special values follow std::exp/log/sqrt/pow: NaN stays NaN,
+ * log(0) = -inf, log(x < 0) = NaN, exp overflows to inf.
+ **********************************************************/
+namespace vmath {
+
+    template <class T>
+    void exp (const T *x, T *y, long n);
+
+    template <class T>
+    void log (const T *x, T *y, long n);
+
+    template <class T>
+    void sqrt (const T *x, T *y, long n);
+
+    template <class T>
+    void pow (const T *x, T *y, long n, double deg);
+}
@@ -0,0 +1,157 @@
+#include "Workspace.hpp"
+
+#include <cstdlib>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+using workspace::ALIGNMENT;
+using workspace::HUGE_PAGE_BYTES;
+
+
+namespace {
+
+    std::atomic<size_t> in_use(0), peak(0), step_peak(0), system_allocs(0);
+    std::atomic<bool> huge_pages(true);
+
+    // Cached blocks of one thread, binned by their exact size.
+    // reset() keeps at most as many blocks in a bin as the thread
+    // asked it for since the last reset(), the rest are released:
+    // blocks freed here by other threads don't pile up.
+    struct Pool {
+        struct Bin {
+            std::vector<void *> blocks;
+            size_t requests = 0; //allocations since the last reset()
+        };
+        std::unordered_map<size_t, Bin> bins;
+        size_t cached = 0;
+        ~Pool ();
+    };
+
+    // Blocks can outlive their thread's pool (e.g. thread_local
+    // buffers destroyed at thread exit), those are freed directly
+    thread_local bool pool_destroyed = false;
+
+    Pool::~Pool () {
+        for (auto &it : this->bins)
+            for (void *ptr : it.second.blocks)
+                std::free(ptr);
+        pool_destroyed = true;
+    }
+
+    Pool &local_pool () {
+        thread_local Pool pool;
+        return pool;
+    }
+
+    // Huge blocks are aligned to the huge page size, so that
+    // they can be backed by transparent huge pages
+    size_t block_alignment (size_t size) {
+        return size >= HUGE_PAGE_BYTES ? HUGE_PAGE_BYTES : ALIGNMENT;
+    }
+
+    // Rounds a request up to the size of the block serving it
+    size_t block_size (size_t bytes) {
+        size_t align = block_alignment(bytes);
+        return (bytes + align - 1) / align * align;
+    }
+
+    void *system_allocate (size_t size) {
+        size_t align = block_alignment(size);
+        void *ptr = std::aligned_alloc(align, size);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (align == HUGE_PAGE_BYTES && huge_pages.load(std::memory_order_relaxed))
+            madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+        system_allocs.fetch_add(1, std::memory_order_relaxed);
+        return ptr;
+    }
+
+    void raise_to (std::atomic<size_t> &max, size_t value) {
+        size_t current = max.load(std::memory_order_relaxed);
+        while (current < value && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+}
+
+
+void *workspace::allocate (size_t bytes) {
+    size_t size = block_size(bytes > 0 ? bytes : 1);
+    void *ptr = nullptr;
+
+    if (!pool_destroyed) {
+        Pool &pool = local_pool();
+        Pool::Bin &bin = pool.bins[size];
+        bin.requests++;
+        if (!bin.blocks.empty()) {
+            ptr = bin.blocks.back();
+            bin.blocks.pop_back();
+            pool.cached -= size;
+        }
+    }
+    if (ptr == nullptr)
+        ptr = system_allocate(size);
+
+    size_t now = in_use.fetch_add(size, std::memory_order_relaxed) + size;
+    raise_to(peak, now);
+    raise_to(step_peak, now);
+    return ptr;
+}
+
+void workspace::deallocate (void *ptr, size_t bytes) noexcept {
+    if (ptr == nullptr)
+        return;
+    size_t size = block_size(bytes > 0 ? bytes : 1);
+    in_use.fetch_sub(size, std::memory_order_relaxed);
+
+    if (pool_destroyed) {
+        std::free(ptr);
+        return;
+    }
+    try {
+        Pool &pool = local_pool();
+        pool.bins[size].blocks.push_back(ptr);
+        pool.cached += size;
+    } catch (...) {
+        std::free(ptr);
+    }
+}
+
+void workspace::reset () {
+    if (!pool_destroyed) {
+        Pool &pool = local_pool();
+        for (auto it = pool.bins.begin(); it != pool.bins.end(); ) {
+            Pool::Bin &bin = it->second;
+            while (bin.blocks.size() > bin.requests) {
+                std::free(bin.blocks.back());
+                bin.blocks.pop_back();
+                pool.cached -= it->first;
+            }
+            if (bin.requests == 0) {
+                it = pool.bins.erase(it);
+                continue;
+            }
+            bin.requests = 0;
+            it++;
+        }
+    }
+    step_peak.store(in_use.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+workspace::Stats workspace::stats () {
+    Stats result;
+    result.in_use = in_use.load(std::memory_order_relaxed);
+    result.peak = peak.load(std::memory_order_relaxed);
+    result.step_peak = step_peak.load(std::memory_order_relaxed);
+    result.cached = pool_destroyed ? 0 : local_pool().cached;
+    result.system_allocs = system_allocs.load(std::memory_order_relaxed);
+    return result;
+}
+
+void workspace::set_huge_pages (bool enabled) {
+    huge_pages.store(enabled, std::memory_order_relaxed);
+}
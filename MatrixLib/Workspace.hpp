@@ -0,0 +1,155 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
+
+/***********************************************************
+ * workspace - per-thread pool of 64-byte aligned blocks that
+ * backs the storage of every Matrix. A training step creates
+ * the same temporaries (activations, masks, exp/log results,
+ * gradients) in the same sizes over and over, so freed blocks
+ * are cached per size and handed out again instead of going
+ * back to the system allocator.
+ * --------------------------------------------------------
+ * Notes:
+ *    -Blocks of HUGE_PAGE_BYTES and more are 2 Mb aligned and
+ *    advised to use transparent huge pages (Linux only), this
+ *    can be switched off with set_huge_pages(false).
+ *    -reset() marks a step boundary: the calling thread keeps
+ *    as many cached blocks of each size as it requested during
+ *    the step, the rest are released, and the step peak is
+ *    started over. Blocks in use are never touched, so it's
+ *    safe to call at any moment.
+ *    -A block freed by another thread than the one that
+ *    allocated it joins the freeing thread's cache, which the
+ *    next reset() of that thread trims back to its own demand.
+ *    -Buffer is the array of a Matrix: a pooled block of its
+ *    own, or a view of memory owned elsewhere (e.g. the packed
+ *    parameters of a model).
+ **********************************************************/
+namespace workspace {
+
+    const size_t ALIGNMENT = 64;
+    const size_t HUGE_PAGE_BYTES = 2 << 20;
+
+    struct Stats {
+        size_t in_use; //bytes held by live blocks
+        size_t peak; //max of in_use since the start
+        size_t step_peak; //max of in_use since the last reset()
+        size_t cached; //bytes kept in the calling thread's cache
+        size_t system_allocs; //blocks requested from the system
+    };
+
+    void *allocate (size_t bytes);
+    void deallocate (void *ptr, size_t bytes) noexcept;
+    void reset ();
+    Stats stats ();
+    void set_huge_pages (bool enabled);
+
+    // std::allocator compatible adapter over the pool
+    template <class T>
+    struct Allocator {
+        using value_type = T;
+
+        Allocator () noexcept = default;
+        template <class U>
+        Allocator (const Allocator<U> &) noexcept {};
+
+        T *allocate (size_t n) {
+            return static_cast<T *>(workspace::allocate(n * sizeof(T)));
+        }
+        void deallocate (T *ptr, size_t n) noexcept {
+            workspace::deallocate(ptr, n * sizeof(T));
+        }
+
+        template <class U>
+        bool operator== (const Allocator<U> &) const noexcept { return true; }
+        template <class U>
+        bool operator!= (const Allocator<U> &) const noexcept { return false; }
+    };
+
+    // Array of trivial T in a pooled block, or a view (see view()).
+    // A copy of a view owns its elements, a move keeps the view, an
+    // assignment to a view writes through it and never resizes it.
+    template <class T>
+    class Buffer {
+    private:
+        T *ptr = nullptr;
+        size_t count = 0;
+        bool owner = true;
+
+        void release () noexcept {
+            if (this->owner && this->ptr)
+                workspace::deallocate(this->ptr, this->count * sizeof(T));
+            this->ptr = nullptr;
+            this->count = 0;
+            this->owner = true;
+        }
+        void copy_from (const T *data, size_t size) {
+            if (!this->owner && size != this->count)
+                throw std::runtime_error("Error: A view can't be resized!\n");
+            this->resize(size);
+            std::copy(data, data + size, this->ptr);
+        }
+    public:
+        Buffer () noexcept = default;
+        Buffer (const Buffer &other) { this->copy_from(other.ptr, other.count); }
+        Buffer (Buffer &&other) noexcept : ptr(other.ptr), count(other.count), owner(other.owner) {
+            other.ptr = nullptr;
+            other.count = 0;
+            other.owner = true;
+        }
+        ~Buffer () { this->release(); }
+
+        Buffer& operator = (const Buffer &other) {
+            if (this != &other)
+                this->copy_from(other.ptr, other.count);
+            return *this;
+        }
+        Buffer& operator = (Buffer &&other) {
+            if (this == &other)
+                return *this;
+            if (!this->owner) {
+                this->copy_from(other.ptr, other.count);
+            } else {
+                this->release();
+                std::swap(this->ptr, other.ptr);
+                std::swap(this->count, other.count);
+                std::swap(this->owner, other.owner);
+            }
+            return *this;
+        }
+
+        // size elements at data, which has to outlive the buffer
+        static Buffer view (T *data, size_t size) {
+            Buffer result;
+            result.ptr = data;
+            result.count = size;
+            result.owner = false;
+            return result;
+        }
+        bool is_view () const { return !this->owner; }
+
+        // New elements are zeros, as in std::vector
+        void resize (size_t size) {
+            if (size == this->count)
+                return;
+            if (!this->owner)
+                throw std::runtime_error("Error: A view can't be resized!\n");
+            T *data = size ? static_cast<T *>(workspace::allocate(size * sizeof(T))) : nullptr;
+            size_t kept = std::min(size, this->count);
+            std::copy(this->ptr, this->ptr + kept, data);
+            std::fill(data + kept, data + size, T());
+            this->release();
+            this->ptr = data;
+            this->count = size;
+        }
+
+        size_t size () const { return this->count; }
+        T *data () { return this->ptr; }
+        const T *data () const { return this->ptr; }
+        T &operator[] (size_t i) { return this->ptr[i]; }
+        const T &operator[] (size_t i) const { return this->ptr[i]; }
+    };
+}
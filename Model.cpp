@@ -1,21 +1,88 @@
 #include "NeuralNet.hpp"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <typeinfo>
 
 // This constructor was supposed to accept layers as parameters, but it doesn't matter anyway
-nn::Model::Model(const int &n_input, const int &n_output, const int &n_hidden, const double &reg) {
+template <class T>
+nn::Model<T>::Model(const int &n_input, const int &n_output, const int &n_hidden, const double &reg, bool fused) {
     this->reg = reg;
     // Push the layers to stack
-    layers.push_back(new FCLayer(n_input, n_hidden));
-    layers.push_back(new ReLULayer());
-    layers.push_back(new FCLayer(n_hidden, n_output));
+    if (fused) {
+        layers.push_back(new FCLayer<T>(n_input, n_hidden, true));
+    } else {
+        layers.push_back(new FCLayer<T>(n_input, n_hidden));
+        layers.push_back(new ReLULayer<T>());
+    }
+    layers.push_back(new FCLayer<T>(n_hidden, n_output));
+    this->mark_sparse_inputs();
+    this->pack();
 }
 
-double nn::Model::feed_forward (Matrix &X, Matrix &y) {
+template <class T>
+void nn::Model<T>::mark_sparse_inputs () {
+    bool after_relu = false;
+    for (auto it : this->layers) {
+        if (typeid(*it) == typeid(FCLayer<T>)) {
+            FCLayer<T> *fc = (FCLayer<T> *)it;
+            fc->set_sparse_input(after_relu);
+            after_relu = fc->has_relu();
+        } else {
+            after_relu = typeid(*it) == typeid(ReLULayer<T>);
+        }
+    }
+}
+
+// Moves the parameters of every FCLayer into the packed buffers, the
+// layers keep working on their Parameters which become views into them
+template <class T>
+void nn::Model<T>::pack (T *values, bool grads) {
+    const long ALIGN = PACK_ALIGN;
+    this->params.clear();
+    for (auto it : layers)
+        if (typeid(*it) == typeid(FCLayer<T>)){
+            auto temp = ((FCLayer<T> *)it)->get_params();
+            this->params.push_back(temp.first);
+            this->params.push_back(temp.second);
+        }
+
+    vector<long> offsets;
+    long total = 0;
+    for (auto param : this->params) {
+        offsets.push_back(total);
+        long size = (long)std::get<0>(param->value.shape()) * std::get<1>(param->value.shape());
+        total += (size + ALIGN - 1) / ALIGN * ALIGN;
+    }
+
+    this->packed = std::make_shared<Parameter<T>>();
+    this->packed->value = values ? Matrix::view(values, 1, (int)total) : Matrix(1, (int)total);
+    this->packed->grad = grads ? Matrix(1, (int)total) : Matrix(0, 0);
+    for (int i = 0; i < (int)this->params.size(); i++) {
+        Parameter<T> *param = this->params[i];
+        int rows = std::get<0>(param->value.shape()), cols = std::get<1>(param->value.shape());
+        // Layers built over the values already are views of the right elements
+        T *value = this->packed->value.data() + offsets[i];
+        if (param->value.data() != value) {
+            if (!values)
+                std::copy(param->value.data(), param->value.data() + (long)rows * cols, value);
+            param->value = Matrix::view(value, rows, cols);
+        }
+        if (!grads)
+            continue;
+        T *grad = this->packed->grad.data() + offsets[i];
+        if (param->grad.shape() == param->value.shape())
+            std::copy(param->grad.data(), param->grad.data() + (long)rows * cols, grad);
+        param->grad = Matrix::view(grad, rows, cols);
+    }
+}
 
-    // Get and nullify parameters
-    auto params = this->get_params();
-    for (int i = 0; i < (int)params.size(); i++)
-        params[i]->grad = params[i]->grad.fill_zeros();
+template <class T>
+double nn::Model<T>::feed_forward (Matrix &X, Matrix &y) {
+
+    // Nullify gradients
+    this->zero_grad();
     
     // Feed forward
     Matrix temp = X;
@@ -33,21 +100,21 @@ double nn::Model::feed_forward (Matrix &X, Matrix &y) {
     }
 
     // Regularization
-    for (int i = 0; i < (int)params.size(); i++) {
-        auto temp = sml.l2_reg(params[i]->value, this->reg);
-        result.first += temp.first;
-        params[i]->grad = params[i]->grad + temp.second;
-    }
+    result.first += this->regularize();
 
     // Return loss
     return result.first;
 }
 
-Matrix nn::Model::predict (Matrix &X) {
-    // Forward prop
-    Matrix temp = X;
+template <class T>
+BasicMatrix<T> nn::Model<T>::predict (Matrix &X) {
+    // Inference forward prop, nothing is kept for a backward and the
+    // activations are overwritten in place where the layer allows it
+    Matrix temp;
+    const Matrix *input = &X;
     for (auto it : layers){
-        temp = (*it).forward(temp);
+        (*it).infer(*input, temp);
+        input = &temp;
     }
 
     // Extract predictions
@@ -56,16 +123,164 @@ Matrix nn::Model::predict (Matrix &X) {
     return pred;
 }
 
-vector<nn::Parameter*> nn::Model::get_params () {
-    vector<nn::Parameter*> result;
+template <class T>
+nn::Model<T> nn::Model<T>::replica () const {
+    Model result;
+    result.reg = this->reg;
+    for (auto it : this->layers) {
+        Layer<T> *layer;
+        if (typeid(*it) == typeid(FCLayer<T>)) {
+            FCLayer<T> *copy = new FCLayer<T>(*(FCLayer<T> *)it);
+            result.owned.emplace_back(copy);
+            layer = copy;
+        } else if (typeid(*it) == typeid(ReLULayer<T>)) {
+            ReLULayer<T> *copy = new ReLULayer<T>(*(ReLULayer<T> *)it);
+            result.owned.emplace_back(copy);
+            layer = copy;
+        } else {
+            throw std::runtime_error("Error: Only FCLayer and ReLULayer models can be replicated!\n");
+        }
+        result.layers.push_back(layer);
+    }
+    // Same layout as this model, the values stay where they are
+    result.pack(this->packed->value.data());
+    return result;
+}
 
-    for (auto it : layers)
-        if (typeid(*it) == typeid(FCLayer)){
-            FCLayer *pt = (FCLayer *)it;
-            auto temp = (*pt).get_params();
-            result.push_back(temp.first);
-            result.push_back(temp.second);
+template <class T>
+template <class L>
+nn::Model<L> nn::Model<T>::cast (double reg) const {
+    Model<L> result;
+    result.reg = reg;
+    for (auto it : this->layers) {
+        Layer<L> *layer;
+        if (typeid(*it) == typeid(FCLayer<T>)) {
+            FCLayer<T> *fc = (FCLayer<T> *)it;
+            auto shape = fc->get_params().first->value.shape();
+            FCLayer<L> *copy = new FCLayer<L>(std::get<0>(shape), std::get<1>(shape), fc->has_relu());
+            result.owned.emplace_back(copy);
+            layer = copy;
+        } else if (typeid(*it) == typeid(ReLULayer<T>)) {
+            ReLULayer<L> *copy = new ReLULayer<L>();
+            result.owned.emplace_back(copy);
+            layer = copy;
+        } else {
+            throw std::runtime_error("Error: Only FCLayer and ReLULayer models can be cast!\n");
         }
-    
+        result.layers.push_back(layer);
+    }
+    result.mark_sparse_inputs();
+    result.pack();
+    this->export_values(result);
     return result;
-}
\ No newline at end of file
+}
+
+template <class T>
+template <class L>
+void nn::Model<T>::export_values (Model<L> &other) const {
+    const T *from = this->packed->value.data();
+    L *to = other.packed->value.data();
+    long size = std::get<1>(this->packed->value.shape());
+    if (std::get<1>(other.packed->value.shape()) != size)
+        throw std::runtime_error("Error: Models aren't compatible!\n");
+    exec::parallel_for(size, exec::ELEMENTWISE, [&](long begin, long end) {
+        #pragma omp simd
+        for (long i = begin; i < end; i++)
+            to[i] = L(from[i]);
+    });
+}
+
+template <class T>
+template <class L>
+bool nn::Model<T>::import_grads (const Model<L> &other, double scale) {
+    const L *from = other.packed->grad.data();
+    T *to = this->packed->grad.data();
+    long size = std::get<1>(this->packed->grad.shape());
+    if (std::get<1>(other.packed->grad.shape()) != size)
+        throw std::runtime_error("Error: Models aren't compatible!\n");
+    T factor = T(scale);
+    return exec::parallel_reduce(size, exec::ELEMENTWISE, true, [&](long begin, long end) {
+        bool finite = true;
+        for (long i = begin; i < end; i++) {
+            to[i] = T(from[i]) * factor;
+            finite &= std::isfinite(from[i]);
+        }
+        return finite;
+    }, [](bool a, bool b) { return a && b; });
+}
+
+template <class T>
+void nn::Model<T>::zero_grad () {
+    this->packed->grad.fill_zeros();
+}
+
+template <class T>
+double nn::Model<T>::regularize () {
+    return this->regularize(0, std::get<1>(this->packed->value.shape()));
+}
+
+template <class T>
+double nn::Model<T>::regularize (long begin, long end) {
+    using C = typename Matrix::compute_type;
+    const T *w = this->packed->value.data() + begin;
+    T *g = this->packed->grad.data() + begin;
+    long size = end - begin;
+    C factor = C(2 * this->reg);
+    double sum = exec::parallel_reduce(size, exec::ELEMENTWISE, 0.0, [&](long begin, long end) {
+        double partial = 0.0;
+        #pragma omp simd reduction(+: partial)
+        for (long i = begin; i < end; i++) {
+            partial += (double)w[i] * (double)w[i];
+            g[i] = T(C(g[i]) + factor * C(w[i]));
+        }
+        return partial;
+    }, [](double a, double b) { return a + b; });
+    return this->reg * sum;
+}
+
+template <class T>
+double nn::Model<T>::grad_norm () const {
+    const T *g = this->packed->grad.data();
+    long size = std::get<1>(this->packed->grad.shape());
+    double sum = exec::parallel_reduce(size, exec::REDUCTION, 0.0, [&](long begin, long end) {
+        double partial = 0.0;
+        #pragma omp simd reduction(+: partial)
+        for (long i = begin; i < end; i++)
+            partial += (double)g[i] * (double)g[i];
+        return partial;
+    }, [](double a, double b) { return a + b; });
+    return std::sqrt(sum);
+}
+
+template <class T>
+vector<std::pair<long, long>> nn::Model<T>::weight_ranges () const {
+    // Every FCLayer packs its weights, then its bias
+    vector<std::pair<long, long>> ranges;
+    const T *packed = this->packed->value.data();
+    for (int i = 0; i < (int)this->params.size(); i += 2) {
+        const Matrix &W = this->params[i]->value;
+        long begin = W.data() - packed;
+        ranges.push_back({ begin, begin + (long)std::get<0>(W.shape()) * std::get<1>(W.shape()) });
+    }
+    return ranges;
+}
+
+template <class T>
+vector<double> nn::Model<T>::densities () {
+    vector<double> result;
+
+    for (auto it : layers)
+        if (typeid(*it) == typeid(FCLayer<T>))
+            result.push_back(((FCLayer<T> *)it)->density());
+
+    return result;
+}
+
+template class nn::Model<double>;
+template class nn::Model<float>;
+template nn::Model<float> nn::Model<double>::cast<float> (double) const;
+template nn::Model<float> nn::Model<float>::cast<float> (double) const;
+template void nn::Model<double>::export_values<float> (Model<float> &) const;
+template void nn::Model<float>::export_values<float> (Model<float> &) const;
+template bool nn::Model<double>::import_grads<float> (const Model<float> &, double);
+template bool nn::Model<float>::import_grads<float> (const Model<float> &, double);
@@ -1,114 +1,264 @@
 #pragma once
 #include <vector>
 #include <memory>
+#include <functional>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "MatrixLib/Matrix.hpp"
+#include "MatrixLib/Random.hpp"
+#include "MatrixLib/Sparse.hpp"
+#include "MatrixLib/QGemm.hpp"
+#include "DataLoader.hpp"
+#include "Distributed.hpp"
 
 /**********************************************************
  * nn - Neural Network namespace, contains all classes to create a simple perceptrone model.
  * --------------------------------------------------------
  * classes:
- *   Parameter - Matrix based parameter for layers
+ *   Parameter - Matrix based parameter for layers, a view into
+ *   the packed parameters once its layer belongs to a Model
  *   Layer - base class for all layers except SoftmaxLayer
- *   FCLayer - fully connected layer, parameters: w, b
+ *   FCLayer - fully connected layer, parameters: w, b, optionally
+ *   fused with the ReLU that follows it
  *   ReLULayer - ReLU layer, parameters: no params
  *   SoftmaxLayer - softmax, cross-entropy and l2 static functions
- *   SGD - adam optimizer, parameters: beta1, beta2, epsilon
- *   Model - NN model, consist of some layers
+ *   Optim - base class of the optimizers, updates a Parameter in place
+ *   SGD - plain gradient descent
+ *   Adam - Adam/AdamW optimizer, parameters: beta1, beta2, epsilon,
+ *   decoupled weight decay
+ *   Model - NN model, consist of some layers, owns the packed
+ *   buffers of all their parameters and gradients
+ *   Plan - static execution plan of a Model training step
+ *   QuantizedFCLayer - int8 inference copy of an FCLayer (+ ReLU)
+ *   QuantizedModel - int8 inference copy of a Model, predict only
+ *   Checkpoint - binary checkpoints of a Model and its training,
+ *   written in the background, mappable for inference
+ * All classes are templates over the element type T of their
+ * matrices and are instantiated for double and float.
  * --------------------------------------------------------
  * Last changes 13 may 2020 by Skyme Factor.
  **********************************************************/
 namespace nn {
 
+    template <class T>
     class Parameter {
     public:
+        using Matrix = BasicMatrix<T>;
         Matrix value;
         Matrix grad;
         Parameter () {};
-        explicit Parameter (Matrix value) {
-            this->value = value;
-            this->grad = Matrix(value.shape());
+        explicit Parameter (Matrix value) : value(std::move(value)) {
+            this->grad = Matrix(this->value.shape());
         }
     };
 
+    template <class T>
     class Layer {
+    public:
+        using Matrix = BasicMatrix<T>;
     protected:
         Matrix X;
         virtual ~Layer() {};
     public:
         virtual Matrix forward (Matrix &) = 0;
         virtual Matrix backward (Matrix &) = 0;
+        /*
+        * Inference forward: caches nothing for the backward and
+        * leaves the layer untouched, out may be the input itself
+        * for the layers that can work in place
+        */
+        virtual void infer (const Matrix &X, Matrix &out) const = 0;
         //virtual std::pair<Parameter, Parameter> get_params () = 0;
     };
 
-    class FCLayer : public Layer {
+    template <class T>
+    class FCLayer : public Layer<T> {
+    public:
+        using Matrix = BasicMatrix<T>;
     private:
-        Parameter W, B;
+        Parameter<T> W, B;
         Matrix X;
+        bool relu; //fused ReLU on the output
+        Matrix mask; //output > 0 of the last forward, for the fused ReLU backward
+        BasicSparseMatrix<T> X_sparse; //input of the last forward on the sparse path
+        bool sparse = false; //the last forward took the sparse path
+        bool sparse_input = false; //the input comes out of a ReLU, only then it's measured
+        double density_sum = 0.0; //input densities since the last density() call
+        long density_count = 0;
     public:
-        explicit FCLayer (int n_input, int n_output);
+        // Inputs out of a ReLU with a smaller share of non-zeros are
+        // multiplied as CSR matrices, 1.0 makes every such input sparse
+        static double sparse_threshold;
+
+        /*
+        * Parameters:
+        *   int n_input, n_output - layer size
+        *   bool relu - the layer is followed by a ReLU, which is fused
+        *   into the product: bias, ReLU and its mask are applied
+        *   in one pass over the output tiles while they're in cache
+        */
+        explicit FCLayer (int n_input, int n_output, bool relu = false);
+        /*
+        * Shape only: W and B are views of n_input x n_output and
+        * 1 x n_output elements at the given memory, not filled and
+        * without gradients, e.g. the pages of a mapped checkpoint
+        */
+        FCLayer (int n_input, int n_output, bool relu, T *W, T *B);
         virtual Matrix forward (Matrix &X) override;
         virtual Matrix backward (Matrix &d_out) override;
-        std::pair<Parameter*, Parameter*> get_params ();
+        virtual void infer (const Matrix &X, Matrix &out) const override;
+        std::pair<Parameter<T>*, Parameter<T>*> get_params ();
+        bool has_relu () const { return this->relu; };
+        // Set by the Model for layers after a ReLU (or a fused one), the others
+        // always take the dense path without measuring their input
+        void set_sparse_input (bool sparse_input) { this->sparse_input = sparse_input; };
+        bool has_sparse_input () const { return this->sparse_input; };
+        double density (); //mean input density since the last call, 1 if not measured
+        void record_density (double density) { this->density_sum += density; this->density_count++; }; //measured by a Plan
     };
 
-    class ReLULayer : public Layer {
+    template <class T>
+    class ReLULayer : public Layer<T> {
+    public:
+        using Matrix = BasicMatrix<T>;
     private:
         Matrix X;
     public:
         ReLULayer () {};
         virtual Matrix forward (Matrix &X) override;
         virtual Matrix backward (Matrix &d_out) override;
+        virtual void infer (const Matrix &X, Matrix &out) const override; //in place if &out == &X
         //virtual std::pair<Parameter, Parameter> get_params () override;
     };
 
+    template <class T>
     class SoftmaxLayer {
     public:
+        using Matrix = BasicMatrix<T>;
         static std::pair<double, Matrix> l2_reg (Matrix &, const double &);
         static Matrix softmax (Matrix &);
         static double ce_loss (Matrix &, Matrix &);
         static std::pair<double, Matrix> softmax_with_ce_loss (Matrix &, Matrix &);
+        static vector<int> labels (const Matrix &); //class indices of a column of labels
+        /*
+        * Fused numerically stable softmax and cross-entropy, linear
+        * in the batch size: one pass per row of the predictions
+        * Parameters:
+        *   const Matrix &predictions - batch x classes logits
+        *   const vector<int> &labels - class index of every row
+        *   Matrix &grad - gets d loss / d predictions, resized if needed
+        * Returns the mean loss
+        */
+        static double softmax_cross_entropy (const Matrix &, const vector<int> &, Matrix &);
+        // The same over row-major buffers, x and grad are rows x cols, the
+        // gradient is multiplied by scale (loss scaling of mixed precision)
+        static double softmax_cross_entropy (const T *, int, int, const int *, T *, double scale = 1.0);
     };
 
+    template <class T>
     class Optim {
     protected:
         virtual ~Optim () {};
     public:
-        virtual Matrix update (Matrix , Matrix , double) = 0;
+        using Matrix = BasicMatrix<T>;
+        /*
+        * Updates param.value from param.grad in place, one pass over
+        * the parameter with no temporaries
+        * Parameters:
+        *   Parameter<T> &param - model parameter and its gradient
+        *   <T> learning_rate - learning rate for the model
+        */
+        virtual void step (Parameter<T> &param, T learning_rate) = 0;
+        // Updated copy of w, for checks outside of a model
+        virtual Matrix update (Matrix w, Matrix d_w, T learning_rate) {
+            Parameter<T> param;
+            param.value = std::move(w);
+            param.grad = std::move(d_w);
+            this->step(param, learning_rate);
+            return param.value;
+        }
         virtual std::shared_ptr<Optim> copy () = 0;
+        // State kept by checkpoints: buffers shaped like the stepped parameter
+        // (empty before the first step) and the number of steps done
+        virtual vector<Matrix *> state () { return {}; };
+        virtual long steps () const { return 0; };
+        virtual void set_steps (long) {};
+        // Sorted [begin, end) element ranges of the stepped parameter that weight decay applies to
+        virtual void set_decay_ranges (const vector<std::pair<long, long>> &) {};
     };
 
     template <class T>
-    class SGD : public Optim {
-    private:
-        T beta_1;
-        T beta_2;
-        T epsilon;
-        Matrix momentum;
-        Matrix velocity;
-        T t;
+    class SGD : public Optim<T> {
     public:
+        using Matrix = BasicMatrix<T>;
         /*
         * Explicit constructor of class SGD
         * Parameters:
         *   No parameters.
         */
         explicit SGD<T> () {};
+        // w -= learning_rate * d_w
+        void step (Parameter<T> &param, T learning_rate) override;
+        // This is used to make possible copying by pointer
+        std::shared_ptr<Optim<T>> copy () override;
+    };
+
+    template <class T>
+    class Adam : public Optim<T> {
+    public:
+        using Matrix = BasicMatrix<T>;
+    private:
+        double beta_1;
+        double beta_2;
+        double epsilon;
+        double weight_decay;
+        Matrix momentum; //first moment of the gradient, sized on the first step
+        Matrix velocity; //second moment of the gradient
+        long t = 0; //steps done
+        vector<std::pair<long, long>> decayed; //element ranges the decay applies to, all if empty
+    public:
         /*
         * Parameters:
-        *   Matrix w - model parameter
-        *   Matrix d_w - gradient for parameter
-        *   <T> learning_rate - learning rate for the model
+        *   double beta_1, beta_2 - decay rates of the moments
+        *   double epsilon - keeps the step finite for zero moments
+        *   double weight_decay - decoupled weight decay (AdamW), the weights
+        *   shrink by learning_rate * weight_decay every step apart from
+        *   the gradient, 0 gives the plain Adam. Only the decay ranges
+        *   shrink once set, e.g. the weights of a packed model without
+        *   its biases and padding.
         */
-        Matrix update (Matrix w, Matrix d_w, T learning_rate);
-        // This is used to make possible copying by pointer
-        std::shared_ptr<Optim> copy ();
+        explicit Adam (double beta_1 = 0.9, double beta_2 = 0.999, double epsilon = 1e-8, double weight_decay = 0.0);
+        // Moments, bias corrections, decay and the weight update in one fused pass
+        void step (Parameter<T> &param, T learning_rate) override;
+        std::shared_ptr<Optim<T>> copy () override;
+        vector<Matrix *> state () override { return { &this->momentum, &this->velocity }; };
+        long steps () const override { return this->t; };
+        void set_steps (long steps) override { this->t = steps; };
+        void set_decay_ranges (const vector<std::pair<long, long>> &ranges) override { this->decayed = ranges; };
     };
 
+    template <class T>
     class Model {
+    public:
+        using Matrix = BasicMatrix<T>;
     private:
         double reg;
-        vector<Layer *> layers;
-        SoftmaxLayer sml;
+        vector<Layer<T> *> layers;
+        SoftmaxLayer<T> sml;
+        // Values and gradients of all parameters, each in one contiguous 64-byte
+        // aligned 1 x size buffer, shared by the copies of the model
+        std::shared_ptr<Parameter<T>> packed;
+        vector<Parameter<T>*> params; //views into packed, in layer order
+        vector<std::shared_ptr<Layer<T>>> owned; //layers of a replica or a cast, the others aren't freed
+        // Packs into the given values instead of copying them, if set. Without grads
+        // the model only does inference and the packed gradients stay empty
+        void pack (T *values = nullptr, bool grads = true);
+        void mark_sparse_inputs (); //FCLayers after a ReLU measure their input density
+        std::shared_ptr<void> storage; //mapped checkpoint the values are read from, if any
+        template <class U> friend class Model;
+        template <class U> friend class Checkpoint;
     public:
         /*
         * Explicit constructor of class Model
@@ -117,29 +267,326 @@ namespace nn {
         *  const int &n_output - number of classes to predict
         *  const int &n_hidden - hidden layer(s) size
         *  const double &reg - regularization strength
+        *  bool fused - fuse the hidden ReLU into the FCLayer before it,
+        *               same results with fewer passes over the activations
         */
         Model () {};
-        explicit Model (const int &, const int &, const int &, const double &);
+        explicit Model (const int &, const int &, const int &, const double &, bool = false);
         double feed_forward (Matrix &, Matrix &);
         Matrix predict (Matrix &);
-        std::vector<Parameter*> get_params();
+        const std::vector<Parameter<T>*> &get_params () const { return this->params; };
+        // All parameters and gradients as one 1 x size Parameter, every
+        // parameter starts at a 64-byte boundary and the padding stays 0
+        Parameter<T> &packed_params () { return *this->packed; };
+        bool trainable () const { return this->packed->grad.shape() == this->packed->value.shape(); }; //has gradients
+        void zero_grad (); //one pass over the packed gradients
+        double regularize (); //adds the L2 term to the gradients in one pass, returns its loss
+        double regularize (long begin, long end); //the same over elements [begin, end) of the packed buffers
+        double grad_norm () const; //L2 norm of the packed gradients
+        vector<std::pair<long, long>> weight_ranges () const; //packed element ranges of the weights, biases left out
+        /*
+        * Copy with layers and gradients of its own that reads and
+        * updates the parameter values of this model, for the workers
+        * of a data-parallel Trainer. It has to be dropped before
+        * this model.
+        */
+        Model replica () const;
+        // Packed offsets are in elements, aligned the same for every T, so that
+        // the packed buffers of a model and of its casts match element by element
+        static const long PACK_ALIGN = 16;
+        /*
+        * Copy of the model in element type L with its own layers,
+        * parameter values converted and L2 strength reg, e.g. the
+        * float32 model of mixed precision training
+        */
+        template <class L>
+        Model<L> cast (double reg) const;
+        template <class L>
+        void export_values (Model<L> &) const; //converts the packed values into those of a cast
+        // Takes the packed gradients of a cast times scale, in one pass,
+        // returns false if any of them is Inf or NaN
+        template <class L>
+        bool import_grads (const Model<L> &, double scale);
+        std::vector<double> densities(); //mean input density of every FCLayer since the last call
+        const std::vector<Layer<T> *> &get_layers () const { return this->layers; };
+        double get_reg () const { return this->reg; };
+    };
+
+    template <class T>
+    class Plan {
+    public:
+        using Matrix = BasicMatrix<T>;
+    private:
+        enum StepKind { FC_FORWARD, RELU_FORWARD, LOSS, FC_BACKWARD, RELU_BACKWARD };
+        struct Step {
+            StepKind kind;
+            FCLayer<T> *layer; //FC steps only
+            int in, out; //buffers, -1 is the input batch (in) or nothing (out)
+            int mask; //buffer whose elements > 0 give the ReLU mask, or -1
+            int x; //FC_BACKWARD: input buffer of the forward
+        };
+        struct Buffer {
+            int cols; //rows are the batch
+            long size; //elements, padded to 64 bytes
+            int first, last; //steps the buffer lives between
+            long offset; //into the arena
+        };
+        Model<T> &model;
+        int batch_size;
+        vector<Step> steps;
+        vector<Buffer> buffers;
+        long arena_size;
+        vector<T, workspace::Allocator<T>> arena;
+        vector<int> labels;
+        double loss_scale = 1.0;
+        // Sparse path of the FCLayers after a ReLU, per buffer: its share of
+        // non-zeros if a RELU_FORWARD counted it this step (else -1) and its
+        // CSR copy if the FC_FORWARD reading it took the sparse path
+        vector<double> density;
+        vector<BasicSparseMatrix<T>> sparse_inputs;
+        vector<char> sparse;
+
+        Plan (Model<T> &, int, bool);
+        int add_buffer (int cols);
+        void place ();
+        T *buffer (int id, const Matrix &X) const;
+    public:
+        /*
+        * Compiles a training step of the model for batches of up to
+        * batch_size rows. Every activation and gradient buffer gets a
+        * fixed offset in one arena, allocated here; buffers whose
+        * lifetimes don't overlap share memory. The CSR copies of the
+        * sparse path come from the workspace pool, so that after the
+        * first step a step makes no allocation.
+        * Parameters:
+        *   Model<T> &model - FCLayer (fused ReLU or not) and ReLULayer stack,
+        *                     has to outlive the plan
+        *   int batch_size - max rows of a batch
+        */
+        Plan (Model<T> &model, int batch_size) : Plan(model, batch_size, true) {};
+        /*
+        * Forward and backward pass, same results as Model::feed_forward:
+        * fills the gradients of the model parameters and returns the
+        * loss. An FCLayer after a ReLU records its input density and
+        * takes the sparse path below FCLayer::sparse_threshold, the
+        * ReLU steps count the non-zeros in their own pass.
+        * Parameters:
+        *   const Matrix &X - batch, at most batch_size rows
+        *   const Matrix &y - column of class indices
+        *   ready - called with the range [begin, end) of the packed
+        *   gradients of every FCLayer as soon as they are final (L2
+        *   included), from the last layer to the first, while the
+        *   backward of the layers before it hasn't run yet
+        */
+        double step (const Matrix &X, const Matrix &y, const std::function<void(long, long)> &ready = nullptr);
+        int capacity () const { return this->batch_size; };
+        void set_loss_scale (double scale) { this->loss_scale = scale; }; //multiplies the loss gradient
+        size_t bytes () const; //planned memory of the activations and gradients
+        size_t unplanned_bytes () const; //the same with a buffer of its own for each
+        static size_t bytes (Model<T> &model, int batch_size); //planned memory, nothing is allocated
+    };
+
+    template <class T>
+    class QuantizedFCLayer {
+    public:
+        using Matrix = BasicMatrix<T>;
+    private:
+        qgemm::PackedB W; //int8 weights, one scale per output channel
+        vector<float> w_scale;
+        vector<float> bias;
+        float x_scale; //input x is quantized to uint8 as x / x_scale + x_zero
+        int x_zero;
+        bool relu; //a ReLU follows, it's applied to the output
+    public:
+        /*
+        * Parameters:
+        *   const Matrix &W, &B - weights and bias of the FCLayer
+        *   double x_min, x_max - calibrated range of the layer input
+        *   bool relu - apply ReLU to the output
+        */
+        QuantizedFCLayer (const Matrix &W, const Matrix &B, double x_min, double x_max, bool relu);
+        Matrix forward (const Matrix &X) const;
+        void set_relu (bool relu) { this->relu = relu; };
     };
 
-    #define DATASET_TYPE std::pair<std::vector<std::vector<double>>, std::vector<double>>
+    template <class T>
+    class QuantizedModel {
+    public:
+        using Matrix = BasicMatrix<T>;
+    private:
+        vector<QuantizedFCLayer<T>> layers;
+    public:
+        /*
+        * Post-training quantization of a trained model: the input
+        * range of every FCLayer is measured on a calibration sample
+        * (a few hundred rows of the train set are enough)
+        * Parameters:
+        *   Model<T> &model - FCLayer and ReLULayer stack
+        *   const Matrix &calibration - sample of model inputs
+        */
+        QuantizedModel (Model<T> &model, const Matrix &calibration);
+        Matrix predict (const Matrix &X) const;
+    };
+
+    // Progress of a Trainer, saved with the parameters to resume from
+    struct TrainingState {
+        long epoch = 0; //epochs done
+        int val_sample = 0; //validation fold of the next epoch
+        double learning_rate = 0.0; //after the decay of the epochs done
+        double loss_scale = 0.0; //of mixed precision, 0 without it
+        rng::Philox::State folds; //shuffler as the validation folds were drawn
+        rng::Philox::State rng; //shuffler after the epochs done
+    };
 
+    /*
+    * Versioned binary checkpoints: a header page with the layers,
+    * the training state and the offsets, then the packed parameter
+    * values and the optimizer state buffers, each starting at a
+    * 4096-byte page. The values are stored as they are in memory
+    * (native endianness, element type of the writer).
+    * --------------------------------------------------------
+    * An instance writes checkpoints in a background thread: save()
+    * copies the state into a snapshot and returns, the file is
+    * written to path.tmp and renamed over path once complete, so
+    * path always holds a whole checkpoint. The static functions
+    * load them back.
+    */
+    template <class T>
+    class Checkpoint {
+    public:
+        using Matrix = BasicMatrix<T>;
+        static const uint32_t VERSION = 1;
+        static const long PAGE = 4096;
+    private:
+        // Snapshot of the last save(), owned by the writer thread until written
+        std::string path;
+        vector<char> header;
+        vector<T> values;
+        vector<T> state;
+        long state_stride = 0; //bytes between the state buffers in the file
+
+        std::thread worker;
+        std::mutex lock;
+        std::condition_variable changed;
+        bool pending = false;
+        bool stopping = false;
+        std::string error; //of the last write, thrown by the next save() or wait()
+        double write_seconds = 0.0;
+        double stall_seconds = 0.0;
+
+        void run ();
+        void write ();
+    public:
+        Checkpoint ();
+        ~Checkpoint ();
+        Checkpoint (const Checkpoint &) = delete;
+        Checkpoint& operator = (const Checkpoint &) = delete;
+        /*
+        * Snapshots the model values, the optimizer state and the
+        * training state and writes them to path in the background.
+        * Waits only for the write of the previous checkpoint.
+        * Parameters:
+        *   const std::string &path - file of the checkpoint
+        *   Model<T> &model - FCLayer and ReLULayer stack
+        *   Optim<T> *optim - optimizer of the packed parameters, or nullptr
+        *   const TrainingState &progress - trainer state to resume from
+        */
+        void save (const std::string &path, Model<T> &model, Optim<T> *optim, const TrainingState &progress);
+        void wait (); //until the last checkpoint is written
+        double write_time () const { return this->write_seconds; }; //seconds spent writing, in the background
+        double stall_time () const { return this->stall_seconds; }; //seconds save() waited for the previous write
+
+        /*
+        * Model stored in a checkpoint of any element type. With mapped
+        * and the same element type, the values aren't read: the layers
+        * are views of the pages of the file. An inference model maps
+        * them read-only, shared by every process that maps the file,
+        * and has no gradients. A trainable one gets gradients and maps
+        * them copy-on-write, the pages it updates become its own.
+        * Otherwise the values are converted into memory of the model.
+        */
+        static Model<T> load_model (const std::string &path, bool mapped = true, bool trainable = false);
+        /*
+        * Loads a checkpoint into model, which has to have the same
+        * layers, and the optimizer state into optim (if not nullptr).
+        * Returns the training state to resume from.
+        */
+        static TrainingState load (const std::string &path, Model<T> &model, Optim<T> *optim);
+    };
+
+    template <class T>
     class Trainer {
+    public:
+        using Matrix = BasicMatrix<T>;
     private:
-        nn::Model model;
-        DATASET_TYPE dataset;
-        nn::Optim* optim;
+        nn::Model<T> model;
+        const Dataset<T> &dataset; //not copied, has to outlive the trainer
+        nn::Optim<T>* optim;
         int num_epochs;
         int batch_size;
         double learning_rate;
         double learning_rate_decay;
+        bool planned; //run the steps through a Plan instead of Model::feed_forward
+        int workers = 1; //data-parallel model replicas, one per thread
+        bool hogwild = false; //workers update the parameters on their own, without a reduction
+        double samples_per_second = 0.0; //training throughput of the last epoch
+        dist::Communicator *comm = nullptr; //ranks of a distributed run, not owned
+        bool mixed = false; //float32 working copy of the model with dynamic loss scaling
+        std::shared_ptr<Checkpoint<T>> writer; //background checkpoint writer, if enabled
+        std::string checkpoint_path;
+        int checkpoint_every = 0; //epochs between checkpoints, 0 disables them
+        TrainingState start; //where the next fit starts, set by resume
+        std::shared_ptr<Optim<T>> resumed_optim; //optimizer with the loaded state, for the next fit
+        rng::Philox generator; //shuffles the batches, own stream of the global seed
     public:
-        explicit Trainer (nn::Model &, DATASET_TYPE &, nn::Optim*, int = 20, int = 20, double = 1e-2, double = 1.0);
+        explicit Trainer (nn::Model<T> &, Dataset<T> &, nn::Optim<T>*, int = 20, int = 20, double = 1e-2, double = 1.0,
+                          bool = true);
+        /*
+        * Trains on workers threads, each with a replica of the model.
+        * Every batch is split into one shard per worker, the weighted
+        * gradients of the shards are summed chunk by chunk into the
+        * model and a single optimizer step follows. With hogwild, every
+        * worker takes whole batches instead and steps the shared
+        * parameters with an optimizer of its own, without any locking.
+        * The Matrix kernels of a worker run serially, 1 worker keeps
+        * them parallel.
+        */
+        void data_parallel (int workers, bool hogwild = false);
+        /*
+        * Trains as one rank of comm: every rank takes its shard of each
+        * batch, the gradients of a layer are all-reduced over the ranks
+        * while the backward of the layers before it runs, and every rank
+        * does the same optimizer step. Each epoch reports the samples/s
+        * and communication time of every rank.
+        */
+        void distribute (dist::Communicator &comm);
+        /*
+        * Mixed precision: the forward and backward run through a Plan
+        * on a float32 copy of the model while the optimizer steps the
+        * parameters of the model, which stay the master weights. The
+        * loss gradient is multiplied by a power of 2 loss scale so the
+        * small float32 gradients don't flush to zero, a step with an
+        * Inf or NaN gradient is skipped and halves the scale, which is
+        * doubled again after 2000 good steps. One worker and rank only.
+        */
+        void mixed_precision (bool enabled = true);
+        /*
+        * Writes a checkpoint to path after every `every` epochs (and
+        * the last one) from a background thread, the epoch only waits
+        * for the copy of the state. Rank 0 writes for all the ranks.
+        * Hogwild workers have optimizer states of their own, so their
+        * checkpoints need a stateless optimizer (SGD).
+        */
+        void checkpoint (const std::string &path, int every = 1);
+        /*
+        * Loads the parameters, the optimizer state and the progress
+        * of a checkpoint, the next fit continues the run from the
+        * epoch after it up to the number of epochs of the trainer.
+        */
+        void resume (const std::string &path);
         vector<vector<int>> split_indices (vector<int> , int, bool = true);
         std::vector<std::vector<double>> fit ();
+        double throughput () const { return this->samples_per_second; }; //training samples/s of the last epoch
         static double compute_accuracy (Matrix &, Matrix &);
     };
 }
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include "NeuralNet.hpp"
+#include "MatrixLib/Gemm.hpp"
+#include "MatrixLib/Reduce.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <typeinfo>
+
+
+template <class T>
+nn::Plan<T>::Plan (Model<T> &model, int batch_size, bool allocate) : model(model), batch_size(batch_size) {
+    if (batch_size < 1)
+        throw std::runtime_error("Batch size has to be positive!");
+
+    // Forward: every FCLayer writes a buffer of its own, a ReLU works in
+    // place. The ReLU output is its mask in the backward too, y > 0
+    // exactly where the input is > 0.
+    auto &layers = model.get_layers();
+    vector<int> inputs, outputs;
+    int current = -1, cols = -1;
+    for (auto it : layers) {
+        inputs.push_back(current);
+        if (typeid(*it) == typeid(FCLayer<T>)) {
+            FCLayer<T> *layer = (FCLayer<T> *)it;
+            auto shape = layer->get_params().first->value.shape();
+            if (cols != -1 && cols != std::get<0>(shape))
+                throw std::runtime_error("Layers aren't compatible!");
+            cols = std::get<1>(shape);
+            int out = this->add_buffer(cols);
+            this->steps.push_back({ FC_FORWARD, layer, current, out, -1, -1 });
+            current = out;
+        } else if (typeid(*it) == typeid(ReLULayer<T>) && current != -1) {
+            this->steps.push_back({ RELU_FORWARD, nullptr, current, current, -1, -1 });
+        } else {
+            throw std::runtime_error("Error: Only FCLayer and ReLULayer models can be planned!\n");
+        }
+        outputs.push_back(current);
+    }
+    if (current == -1)
+        throw std::runtime_error("Error: The model has no FCLayer!\n");
+
+    // Loss gradient, then the layers in reverse. The first FCLayer
+    // doesn't compute the gradient of its input, nothing needs it.
+    int grad = this->add_buffer(cols);
+    this->steps.push_back({ LOSS, nullptr, current, grad, -1, -1 });
+    for (int l = (int)layers.size() - 1; l >= 0; l--) {
+        if (typeid(*layers[l]) == typeid(FCLayer<T>)) {
+            FCLayer<T> *layer = (FCLayer<T> *)layers[l];
+            int mask = layer->has_relu() ? outputs[l] : -1;
+            int d_input = -1;
+            if (inputs[l] != -1)
+                d_input = this->add_buffer(std::get<0>(layer->get_params().first->value.shape()));
+            this->steps.push_back({ FC_BACKWARD, layer, grad, d_input, mask, inputs[l] });
+            grad = d_input;
+        } else {
+            this->steps.push_back({ RELU_BACKWARD, nullptr, grad, grad, outputs[l], -1 });
+        }
+    }
+
+    // Lifetimes: from the first to the last step using a buffer
+    for (auto &buffer : this->buffers) {
+        buffer.first = (int)this->steps.size();
+        buffer.last = -1;
+    }
+    for (int s = 0; s < (int)this->steps.size(); s++) {
+        for (int id : { this->steps[s].in, this->steps[s].out, this->steps[s].mask, this->steps[s].x }) {
+            if (id < 0)
+                continue;
+            this->buffers[id].first = std::min(this->buffers[id].first, s);
+            this->buffers[id].last = std::max(this->buffers[id].last, s);
+        }
+    }
+    this->place();
+
+    if (allocate) {
+        this->arena.resize(this->arena_size);
+        this->labels.resize(batch_size);
+        this->density.resize(this->buffers.size());
+        this->sparse_inputs.resize(this->buffers.size());
+        this->sparse.resize(this->buffers.size());
+    }
+}
+
+template <class T>
+int nn::Plan<T>::add_buffer (int cols) {
+    const long ALIGN = 64 / sizeof(T);
+    long size = ((long)this->batch_size * cols + ALIGN - 1) / ALIGN * ALIGN;
+    this->buffers.push_back({ cols, size, 0, 0, 0 });
+    return (int)this->buffers.size() - 1;
+}
+
+// First fit, largest buffers first: a buffer goes to the lowest offset
+// that doesn't overlap a placed buffer living at the same time
+template <class T>
+void nn::Plan<T>::place () {
+    vector<int> order(this->buffers.size());
+    for (int i = 0; i < (int)order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return this->buffers[a].size > this->buffers[b].size;
+    });
+
+    this->arena_size = 0;
+    vector<int> placed;
+    for (int id : order) {
+        Buffer &buffer = this->buffers[id];
+        vector<const Buffer *> live;
+        for (int other : placed) {
+            const Buffer &o = this->buffers[other];
+            if (o.first <= buffer.last && buffer.first <= o.last)
+                live.push_back(&o);
+        }
+        std::sort(live.begin(), live.end(), [](const Buffer *a, const Buffer *b) { return a->offset < b->offset; });
+        long offset = 0;
+        for (auto o : live) {
+            if (offset + buffer.size <= o->offset)
+                break;
+            offset = std::max(offset, o->offset + o->size);
+        }
+        buffer.offset = offset;
+        this->arena_size = std::max(this->arena_size, offset + buffer.size);
+        placed.push_back(id);
+    }
+}
+
+template <class T>
+T *nn::Plan<T>::buffer (int id, const Matrix &X) const {
+    if (id < 0)
+        return const_cast<T *>(X.data());
+    return const_cast<T *>(this->arena.data()) + this->buffers[id].offset;
+}
+
+template <class T>
+double nn::Plan<T>::step (const Matrix &X, const Matrix &y, const std::function<void(long, long)> &ready) {
+    using C = typename Matrix::compute_type;
+    int rows = std::get<0>(X.shape());
+    if (rows > this->batch_size || std::get<0>(y.shape()) != rows)
+        throw std::runtime_error("Batch doesn't fit the plan!");
+    const T *y_data = y.data();
+    int y_cols = std::get<1>(y.shape());
+    for (int i = 0; i < rows; i++)
+        this->labels[i] = (int)y_data[(long)i * y_cols];
+    std::fill(this->density.begin(), this->density.end(), -1.0);
+
+    double loss = 0.0;
+    for (auto &step : this->steps) {
+        T *in = this->buffer(step.in, X);
+        T *out = step.out >= 0 ? this->buffer(step.out, X) : nullptr;
+        switch (step.kind) {
+        case FC_FORWARD: {
+            auto params = step.layer->get_params();
+            int k = std::get<0>(params.first->value.shape()), n = std::get<1>(params.first->value.shape());
+            if (step.in < 0 && std::get<1>(X.shape()) != k)
+                throw std::runtime_error("Matrices aren't compatible!");
+            // Input out of a ReLU: its density (counted by the ReLU step if it
+            // had one) picks the path, as in FCLayer::forward
+            bool sparse = false;
+            if (step.in >= 0 && step.layer->has_sparse_input()) {
+                double density = this->density[step.in];
+                if (density < 0.0)
+                    density = BasicSparseMatrix<T>::density(Matrix::view(in, rows, k));
+                step.layer->record_density(density);
+                sparse = density < FCLayer<T>::sparse_threshold;
+                this->sparse[step.in] = sparse;
+            }
+            if (sparse) {
+                BasicSparseMatrix<T> &input = this->sparse_inputs[step.in];
+                input = BasicSparseMatrix<T>(Matrix::view(in, rows, k));
+                Matrix product = Matrix::view(out, rows, n);
+                BasicSparseMatrix<T>::spmm(C(1), input, false, params.first->value, C(0), product);
+                const T *bias = params.second->value.data();
+                bool relu = step.layer->has_relu();
+                exec::parallel_for(rows, exec::ELEMENTWISE, [&](long begin, long end) {
+                    for (long i = begin; i < end; i++) {
+                        T *row = out + i * n;
+                        #pragma omp simd
+                        for (int j = 0; j < n; j++) {
+                            C v = C(row[j]) + C(bias[j]);
+                            row[j] = T(relu && v <= C(0) ? C(0) : v);
+                        }
+                    }
+                }, n);
+                break;
+            }
+            // Bias and fused ReLU in the epilogue, as FCLayer::forward
+            gemm::Epilogue<T> epilogue;
+            epilogue.bias = params.second->value.data();
+            epilogue.relu = step.layer->has_relu();
+            gemm::gemm<T>(false, false, rows, n, k, C(1), in, k, params.first->value.data(), n,
+                          C(0), out, n, epilogue);
+            break;
+        }
+        case RELU_FORWARD: {
+            // The non-zeros are counted in the same pass, for the next FCLayer
+            long size = (long)rows * this->buffers[step.out].cols;
+            long count = exec::parallel_reduce(size, exec::ELEMENTWISE, 0L, [&](long begin, long end) {
+                long count = 0;
+                #pragma omp simd reduction(+: count)
+                for (long i = begin; i < end; i++) {
+                    bool positive = C(out[i]) > C(0);
+                    out[i] = T((positive ? C(1) : C(0)) * C(out[i]));
+                    count += positive;
+                }
+                return count;
+            }, [](long a, long b) { return a + b; });
+            this->density[step.out] = size > 0 ? (double)count / size : 0.0;
+            break;
+        }
+        case LOSS:
+            loss = SoftmaxLayer<T>::softmax_cross_entropy(in, rows, this->buffers[step.out].cols,
+                                                         this->labels.data(), out, this->loss_scale);
+            break;
+        case FC_BACKWARD: {
+            auto params = step.layer->get_params();
+            int k = std::get<0>(params.first->value.shape()), n = std::get<1>(params.first->value.shape());
+            // Gradient through the fused ReLU, in place
+            if (step.mask >= 0) {
+                const T *mask = this->buffer(step.mask, X);
+                exec::parallel_for((long)rows * n, exec::ELEMENTWISE, [&](long begin, long end) {
+                    #pragma omp simd
+                    for (long i = begin; i < end; i++)
+                        in[i] = T(C(in[i]) * ((C(mask[i]) > C(0)) ? C(1) : C(0)));
+                });
+            }
+            // W.grad = X^T x d_out, B.grad = sum of d_out rows, d_input = d_out x W^T
+            if (step.x >= 0 && this->sparse[step.x]) {
+                BasicSparseMatrix<T>::spmm(C(1), this->sparse_inputs[step.x], true, Matrix::view(in, rows, n),
+                                           C(0), params.first->grad);
+            } else {
+                gemm::gemm<T>(true, false, k, n, rows, C(1), this->buffer(step.x, X), k, in, n,
+                              C(0), params.first->grad.data(), n);
+            }
+            reduce::reduce(reduce::SUM, 0, (const T *)in, rows, n, params.second->grad.data());
+            if (out)
+                gemm::gemm<T>(false, true, rows, k, n, C(1), in, n, params.first->value.data(), n, C(0), out, k);
+            // The layer's gradients are final once the L2 term is in, W and B are adjacent in the packed buffers
+            const T *packed = this->model.packed_params().grad.data();
+            long begin = params.first->grad.data() - packed, end = params.second->grad.data() + n - packed;
+            loss += this->model.regularize(begin, end);
+            if (ready)
+                ready(begin, end);
+            break;
+        }
+        case RELU_BACKWARD: {
+            const T *mask = this->buffer(step.mask, X);
+            long size = (long)rows * this->buffers[step.out].cols;
+            exec::parallel_for(size, exec::ELEMENTWISE, [&](long begin, long end) {
+                #pragma omp simd
+                for (long i = begin; i < end; i++)
+                    out[i] = T(C(in[i]) * ((C(mask[i]) > C(0)) ? C(1) : C(0)));
+            });
+            break;
+        }
+        }
+    }
+    return loss;
+}
+
+template <class T>
+size_t nn::Plan<T>::bytes () const {
+    return this->arena_size * sizeof(T);
+}
+
+template <class T>
+size_t nn::Plan<T>::unplanned_bytes () const {
+    size_t total = 0;
+    for (auto &buffer : this->buffers)
+        total += buffer.size * sizeof(T);
+    return total;
+}
+
+template <class T>
+size_t nn::Plan<T>::bytes (Model<T> &model, int batch_size) {
+    return Plan(model, batch_size, false).bytes();
+}
+
+template class nn::Plan<double>;
+template class nn::Plan<float>;
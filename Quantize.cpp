@@ -0,0 +1,118 @@
+#include "NeuralNet.hpp"
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <typeinfo>
+
+
+template <class T>
+nn::QuantizedFCLayer<T>::QuantizedFCLayer (const Matrix &W, const Matrix &B, double x_min, double x_max, bool relu) {
+    int k = std::get<0>(W.shape()), n = std::get<1>(W.shape());
+    const T *w = W.data();
+    const T *b = B.data();
+
+    // Symmetric per output channel weight scales, w = w_scale * int8
+    vector<int8_t> quantized((long)k * n);
+    this->w_scale.assign(n, 1.0f);
+    this->bias.assign(n, 0.0f);
+    for (int j = 0; j < n; j++) {
+        double max_abs = 0.0;
+        for (int i = 0; i < k; i++)
+            max_abs = std::max(max_abs, std::fabs((double)w[(long)i * n + j]));
+        double scale = max_abs > 0.0 ? max_abs / 127.0 : 1.0;
+        for (int i = 0; i < k; i++)
+            quantized[(long)i * n + j] = (int8_t)std::lround((double)w[(long)i * n + j] / scale);
+        this->w_scale[j] = (float)scale;
+        this->bias[j] = (float)b[j];
+    }
+    this->W = qgemm::pack_b(quantized.data(), k, n);
+
+    // Asymmetric input range, 0 stays exact (padding, ReLU zeros)
+    x_min = std::min(x_min, 0.0);
+    x_max = std::max(x_max, 0.0);
+    double scale = (x_max - x_min) / 255.0;
+    this->x_scale = scale > 0.0 ? (float)scale : 1.0f;
+    this->x_zero = (int)std::lround(-x_min / this->x_scale);
+    this->relu = relu;
+}
+
+template <class T>
+BasicMatrix<T> nn::QuantizedFCLayer<T>::forward (const Matrix &X) const {
+    int m = std::get<0>(X.shape()), k = std::get<1>(X.shape());
+    int lda = this->W.k_padded, n = this->W.n;
+    if (k != this->W.k)
+        throw std::runtime_error("Matrices aren't compatible!");
+
+    // Quantize the input rows to uint8, clamped to the calibrated range
+    vector<uint8_t, workspace::Allocator<uint8_t>> x_q((long)m * lda);
+    const T *x = X.data();
+    float inv_scale = 1.0f / this->x_scale, zero = (float)this->x_zero;
+    exec::parallel_for(m, exec::ELEMENTWISE, [&](long begin, long end) {
+        for (long i = begin; i < end; i++) {
+            const T *row = x + i * k;
+            uint8_t *q = x_q.data() + i * lda;
+            #pragma omp simd
+            for (int j = 0; j < k; j++) {
+                float v = std::min(std::max((float)row[j] * inv_scale + zero, 0.0f), 255.0f);
+                q[j] = (uint8_t)(int)(v + 0.5f);
+            }
+            for (int j = k; j < lda; j++)
+                q[j] = 0;
+        }
+    }, k);
+
+    vector<int32_t, workspace::Allocator<int32_t>> acc((long)m * n);
+    qgemm::gemm(m, x_q.data(), lda, this->W, acc.data(), n);
+
+    // x * w = x_scale * w_scale * (acc - x_zero * sum(w)), then bias and ReLU
+    Matrix result(m, n);
+    T *out = result.data();
+    const int32_t *sums = this->W.column_sums.data();
+    exec::parallel_for(m, exec::ELEMENTWISE, [&](long begin, long end) {
+        for (long i = begin; i < end; i++) {
+            const int32_t *a = acc.data() + i * n;
+            T *row = out + i * n;
+            #pragma omp simd
+            for (int j = 0; j < n; j++) {
+                float v = (float)(a[j] - this->x_zero * sums[j]) * (this->x_scale * this->w_scale[j]) + this->bias[j];
+                row[j] = T(this->relu ? std::max(v, 0.0f) : v);
+            }
+        }
+    }, n);
+    return result;
+}
+
+template <class T>
+nn::QuantizedModel<T>::QuantizedModel (Model<T> &model, const Matrix &calibration) {
+    // Run the calibration sample through the float model, recording the
+    // input range of every FCLayer, a ReLU is folded into the layer before it
+    Matrix temp = calibration;
+    for (auto it : model.get_layers()) {
+        if (typeid(*it) == typeid(FCLayer<T>)) {
+            auto params = ((FCLayer<T> *)it)->get_params();
+            long size = (long)std::get<0>(temp.shape()) * std::get<1>(temp.shape());
+            auto range = std::minmax_element(temp.data(), temp.data() + size);
+            double x_min = size ? (double)*range.first : 0.0, x_max = size ? (double)*range.second : 0.0;
+            this->layers.emplace_back(params.first->value, params.second->value, x_min, x_max,
+                                      ((FCLayer<T> *)it)->has_relu());
+        } else if (typeid(*it) == typeid(ReLULayer<T>) && !this->layers.empty()) {
+            this->layers.back().set_relu(true);
+        } else {
+            throw std::runtime_error("Error: Only FCLayer and ReLULayer models can be quantized!\n");
+        }
+        it->infer(temp, temp);
+    }
+}
+
+template <class T>
+BasicMatrix<T> nn::QuantizedModel<T>::predict (const Matrix &X) const {
+    Matrix temp = X;
+    for (auto &layer : this->layers)
+        temp = layer.forward(temp);
+    return temp.argmax(1);
+}
+
+template class nn::QuantizedFCLayer<double>;
+template class nn::QuantizedFCLayer<float>;
+template class nn::QuantizedModel<double>;
+template class nn::QuantizedModel<float>;
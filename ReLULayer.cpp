@@ -1,12 +1,31 @@
 #include "NeuralNet.hpp"
 
 
-Matrix nn::ReLULayer::forward (Matrix &X) {
+template <class T>
+BasicMatrix<T> nn::ReLULayer<T>::forward (Matrix &X) {
     this->X = (X > 0);
     return this->X * X;
 }
 
-Matrix nn::ReLULayer::backward (Matrix &d_out) {
+template <class T>
+BasicMatrix<T> nn::ReLULayer<T>::backward (Matrix &d_out) {
     Matrix d_result = d_out * this->X;
     return d_result;
-}
\ No newline at end of file
+}
+
+template <class T>
+void nn::ReLULayer<T>::infer (const Matrix &X, Matrix &out) const {
+    using C = typename Matrix::compute_type;
+    if (&out != &X)
+        out = X;
+    T *data = out.data();
+    long size = (long)std::get<0>(out.shape()) * std::get<1>(out.shape());
+    exec::parallel_for(size, exec::ELEMENTWISE, [&](long begin, long end) {
+        #pragma omp simd
+        for (long i = begin; i < end; i++)
+            data[i] = T(((C(data[i]) > C(0)) ? C(1) : C(0)) * C(data[i]));
+    });
+}
+
+template class nn::ReLULayer<double>;
+template class nn::ReLULayer<float>;
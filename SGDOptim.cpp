@@ -4,14 +4,23 @@
 
 
 template <class T>
-Matrix nn::SGD<T>::update (Matrix w, Matrix d_w, T learning_rate){
-    Matrix half = d_w * learning_rate;
-    return w - half;
+void nn::SGD<T>::step (Parameter<T> &param, T learning_rate){
+    using C = typename Matrix::compute_type;
+    T *w = param.value.data();
+    const T *d_w = param.grad.data();
+    long size = (long)std::get<0>(param.value.shape()) * std::get<1>(param.value.shape());
+    C lr = C(learning_rate);
+    exec::parallel_for(size, exec::ELEMENTWISE, [&](long begin, long end) {
+        #pragma omp simd
+        for (long i = begin; i < end; i++)
+            w[i] = T(C(w[i]) - lr * C(d_w[i]));
+    });
 }
 
 template <class T>
-std::shared_ptr<nn::Optim> nn::SGD<T>::copy () {
-    return std::shared_ptr<nn::Optim>( new SGD(*this) );
+std::shared_ptr<nn::Optim<T>> nn::SGD<T>::copy () {
+    return std::shared_ptr<nn::Optim<T>>( new SGD(*this) );
 }
 
-template class nn::SGD<double>;
\ No newline at end of file
+template class nn::SGD<double>;
+template class nn::SGD<float>;
@@ -1,14 +1,19 @@
 #include "NeuralNet.hpp"
+#include "MatrixLib/VecMath.hpp"
 #include <iostream>
+#include <cmath>
+#include <stdexcept>
 
-std::pair<double, Matrix> nn::SoftmaxLayer::l2_reg (Matrix &W, const double &reg_strength){
+template <class T>
+std::pair<double, BasicMatrix<T>> nn::SoftmaxLayer<T>::l2_reg (Matrix &W, const double &reg_strength){
     double loss = ((W ^ 2).sum(0).sum(1))(0, 0) * reg_strength;
     Matrix grad = W * reg_strength * 2;
 
     return std::pair<double, Matrix>(loss, grad);
 }
 
-Matrix nn::SoftmaxLayer::softmax (Matrix &predictions) {
+template <class T>
+BasicMatrix<T> nn::SoftmaxLayer<T>::softmax (Matrix &predictions) {
 
     Matrix predictions_max = predictions.max(1);
     Matrix predictions_normal = predictions - predictions_max;
@@ -18,46 +23,95 @@ Matrix nn::SoftmaxLayer::softmax (Matrix &predictions) {
     return probs;
 }
 
-// TODO: fix this function (Doesn't affect the result!)
-double nn::SoftmaxLayer::ce_loss (Matrix &probs, Matrix &gt_index) {
-    double loss;
+template <class T>
+double nn::SoftmaxLayer<T>::ce_loss (Matrix &probs, Matrix &gt_index) {
+    // Mean of -log p over the probabilities of the ground truth classes
+    vector<int> classes = labels(gt_index);
+    int rows = std::get<0>(probs.shape());
+    if ((int)classes.size() != rows)
+        throw std::runtime_error("Labels don't match the predictions!");
 
-    int shape = std::get<0>(gt_index.shape());
-    Matrix loss_array(shape, std::get<0>(probs.shape()));
-    for (int j = 0; j < std::get<0>(probs.shape()); j++ )
-        for (int i = 0; i < shape; i++) {
-            loss_array(i, j) = probs(j, gt_index(i, 0));
-        }
-    
-    loss_array = - (loss_array.log()).mean(0).mean(1);
-    loss = loss_array(0, 0);
+    double loss = 0.0;
+    for (int i = 0; i < rows; i++)
+        loss -= std::log((double)probs(i, classes[i]));
 
-    return loss;
+    return rows > 0 ? loss / rows : 0.0;
 }
 
-std::pair<double, Matrix> nn::SoftmaxLayer::softmax_with_ce_loss(Matrix &predictions, Matrix &gt_index){
-    Matrix zeroes(predictions.shape());
+template <class T>
+std::pair<double, BasicMatrix<T>> nn::SoftmaxLayer<T>::softmax_with_ce_loss(Matrix &predictions, Matrix &gt_index){
+    Matrix grad;
+    double loss = softmax_cross_entropy(predictions, labels(gt_index), grad);
 
-    zeroes.fill_zeros();
+    return std::pair<double, Matrix>(loss, grad);
+}
 
-    // Marking the ground truth
-    if (predictions.ndim() > 1) {
-        for (int i = 0; i < std::get<0>(gt_index.shape()); i++){
-            zeroes(i, gt_index(i, 0)) = 1;
-        }
-    } else {
-        zeroes(0, gt_index(0, 0)) = 1;
-    }
+template <class T>
+vector<int> nn::SoftmaxLayer<T>::labels (const Matrix &gt_index) {
+    int rows = std::get<0>(gt_index.shape()), cols = std::get<1>(gt_index.shape());
+    const T *src = gt_index.data();
+    vector<int> result(rows);
+    for (int i = 0; i < rows; i++)
+        result[i] = (int)src[(long)i * cols];
 
-    // Compute sm and ce
-    Matrix grad = softmax(predictions);
-    double loss = ce_loss(grad, gt_index);
-    grad = grad - zeroes;
+    return result;
+}
 
-    // Normalize grad
-    if (predictions.ndim() > 1)
-        grad = grad / std::get<0>(predictions.shape());
+// One pass over every row: the shifted exponents are written straight
+// into the gradient row, the loss of the row is the log-softmax of its
+// label, log(sum) - (x[label] - max), and the row becomes
+// (softmax - one_hot) / rows. Rows are split between threads.
+template <class T>
+double nn::SoftmaxLayer<T>::softmax_cross_entropy (const Matrix &predictions, const vector<int> &labels, Matrix &grad) {
+    int rows = std::get<0>(predictions.shape()), cols = std::get<1>(predictions.shape());
+    if ((int)labels.size() != rows)
+        throw std::runtime_error("Labels don't match the predictions!");
+    if (grad.shape() != predictions.shape())
+        grad = Matrix(rows, cols);
 
-    return std::pair<double, Matrix>(loss, grad);
-    
-}
\ No newline at end of file
+    return softmax_cross_entropy(predictions.data(), rows, cols, labels.data(), grad.data());
+}
+
+template <class T>
+double nn::SoftmaxLayer<T>::softmax_cross_entropy (const T *x, int rows, int cols, const int *labels, T *g, double scale) {
+    for (int i = 0; i < rows; i++)
+        if (labels[i] < 0 || labels[i] >= cols)
+            throw std::runtime_error("Label out of range!");
+
+    // rows / scale is exact for the power of 2 scales, and is rows without scaling
+    T divisor = T(rows) / T(scale);
+    double loss = exec::parallel_reduce(rows, exec::TRANSCENDENTAL, 0.0, [&](long begin, long end) {
+        double loss = 0.0;
+        for (long i = begin; i < end; i++) {
+            const T *row = x + i * cols;
+            T *g_row = g + i * cols;
+            int label = labels[i];
+
+            T max = row[0];
+            #pragma omp simd reduction(max: max)
+            for (int j = 1; j < cols; j++)
+                max = std::max(max, row[j]);
+            #pragma omp simd
+            for (int j = 0; j < cols; j++)
+                g_row[j] = row[j] - max;
+            vmath::exp(g_row, g_row, cols);
+            T sum = 0;
+            #pragma omp simd reduction(+: sum)
+            for (int j = 0; j < cols; j++)
+                sum += g_row[j];
+
+            loss += std::log((double)sum) - (double)(row[label] - max);
+            T p_label = g_row[label] / sum;
+            #pragma omp simd
+            for (int j = 0; j < cols; j++)
+                g_row[j] = g_row[j] / sum / divisor;
+            g_row[label] = (p_label - T(1)) / divisor;
+        }
+        return loss;
+    }, [](double a, double b) { return a + b; }, cols);
+
+    return rows > 0 ? loss / rows : 0.0;
+}
+
+template class nn::SoftmaxLayer<double>;
+template class nn::SoftmaxLayer<float>;
@@ -4,17 +4,26 @@
 #include <algorithm>
 #include <numeric>
 #include <memory>
+#include <limits>
+#include <stdexcept>
 #include "DataLoader.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-nn::Trainer::Trainer (nn::Model &model,
-                      DATASET_TYPE &dataset,
-                      nn::Optim* optim,
-                      int num_epochs,
-                      int batch_size,
-                      double learning_rate,
-                      double learning_rate_decay) {
+template <class T>
+nn::Trainer<T>::Trainer (nn::Model<T> &model,
+                         Dataset<T> &dataset,
+                         nn::Optim<T>* optim,
+                         int num_epochs,
+                         int batch_size,
+                         double learning_rate,
+                         double learning_rate_decay,
+                         bool planned) : dataset(dataset) {
+    if (!model.trainable())
+        throw std::runtime_error("Error: The model was loaded for inference only!\n");
     this->model = model;
-    this->dataset = dataset;
+    this->planned = planned;
     this->optim = optim;
     this->num_epochs = num_epochs;
     this->batch_size = batch_size;
@@ -22,8 +31,44 @@ nn::Trainer::Trainer (nn::Model &model,
     this->learning_rate_decay = learning_rate_decay;
 }
 
+template <class T>
+void nn::Trainer<T>::data_parallel (int workers, bool hogwild) {
+    if (workers < 1)
+        throw std::runtime_error("Number of workers has to be positive!");
+    this->workers = workers;
+    this->hogwild = hogwild;
+}
+
+template <class T>
+void nn::Trainer<T>::distribute (dist::Communicator &comm) {
+    this->comm = &comm;
+}
+
+template <class T>
+void nn::Trainer<T>::mixed_precision (bool enabled) {
+    this->mixed = enabled;
+}
+
+template <class T>
+void nn::Trainer<T>::checkpoint (const std::string &path, int every) {
+    if (every < 1)
+        throw std::runtime_error("Error: Checkpoints have to be at least 1 epoch apart!\n");
+    this->checkpoint_path = path;
+    this->checkpoint_every = every;
+    if (!this->writer)
+        this->writer = std::make_shared<Checkpoint<T>>();
+}
 
-double nn::Trainer::compute_accuracy (Matrix &pred, Matrix &gt) {
+template <class T>
+void nn::Trainer<T>::resume (const std::string &path) {
+    this->resumed_optim = this->optim->copy();
+    this->start = Checkpoint<T>::load(path, this->model, this->resumed_optim.get());
+    this->learning_rate = this->start.learning_rate;
+}
+
+
+template <class T>
+double nn::Trainer<T>::compute_accuracy (Matrix &pred, Matrix &gt) {
     double accuracy, correct = 0;
     int size = std::get<0>(gt.shape());
     for (int i = 0; i < size; i++)
@@ -37,10 +82,11 @@ double nn::Trainer::compute_accuracy (Matrix &pred, Matrix &gt) {
 }
 
 
-vector<vector<int>> nn::Trainer::split_indices (vector<int> indices, int splits, bool shuffle) {
+template <class T>
+vector<vector<int>> nn::Trainer<T>::split_indices (vector<int> indices, int splits, bool shuffle) {
     // Shuffle batch indices if needed
     if (shuffle)
-        std::random_shuffle(indices.begin(), indices.end());
+        std::shuffle(indices.begin(), indices.end(), this->generator);
     
     // Split shuffled indices for batches
     int size = (int)indices.size() / splits;
@@ -56,26 +102,95 @@ vector<vector<int>> nn::Trainer::split_indices (vector<int> indices, int splits,
 }
 
 
-vector<vector<double>> nn::Trainer::fit () {
-    // Setup optimizers for every param of the model
-    vector<std::shared_ptr<Optim>> optimizers;
-    for (auto it : model.get_params()){
-        auto new_optim = optim->copy();
-        optimizers.push_back(new_optim);
-    }
+template <class T>
+vector<vector<double>> nn::Trainer<T>::fit () {
+    // Setup the optimizer, it updates all the packed params of the model at once,
+    // a resumed run continues with the loaded one
+    std::shared_ptr<Optim<T>> optimizer = this->resumed_optim ? this->resumed_optim : optim->copy();
+    this->resumed_optim.reset();
+    optimizer->set_decay_ranges(this->model.weight_ranges());
+    TrainingState start = this->start;
+    this->start = TrainingState();
+    bool resumed = start.epoch > 0;
+
+    // Replicas of the data-parallel workers, the first one is the model itself,
+    // with their batch buffers and plans. Hogwild workers step on their own.
+    int workers = this->workers;
+    int ranks = this->comm ? this->comm->size() : 1;
+    if (ranks > 1 && workers > 1)
+        throw std::runtime_error("Error: Distributed training runs one worker per rank!\n");
+    vector<Model<T>> replicas;
+    replicas.reserve(workers);
+    replicas.push_back(this->model);
+    for (int w = 1; w < workers; w++)
+        replicas.push_back(this->model.replica());
+    vector<Matrix> batch_X(workers), batch_y(workers);
+    vector<std::unique_ptr<Plan<T>>> plans(workers);
+    // Every Hogwild worker has an optimizer state of its own, which a checkpoint doesn't hold
+    vector<std::shared_ptr<Optim<T>>> optimizers;
+    if (this->writer && this->hogwild && workers > 1 && !optimizer->state().empty())
+        throw std::runtime_error("Error: Checkpoints of Hogwild training need a stateless optimizer!\n");
+    if (this->hogwild)
+        for (int w = 0; w < workers; w++)
+            optimizers.push_back(optimizer->copy());
+
+    // Loss and gradients of one worker on a set of samples, left in its replica,
+    // ready gets the ranges of the packed gradients as they are done
+    auto compute = [&](int w, const vector<int> &samples, const std::function<void(long, long)> &ready = nullptr) {
+        // the batch is gathered into the same buffers every step
+        DataLoader::gather(dataset.first, dataset.second, samples, batch_X[w], batch_y[w]);
+        if (!this->planned) {
+            double loss = replicas[w].feed_forward(batch_X[w], batch_y[w]);
+            if (ready)
+                ready(0, std::get<1>(replicas[w].packed_params().grad.shape()));
+            return loss;
+        }
+        if (!plans[w] || (int)samples.size() > plans[w]->capacity()) {
+            plans[w].reset(new Plan<T>(replicas[w], (int)samples.size()));
+            if (w == 0)
+                std::cout << "Plan for batch " << samples.size() << ": " << plans[w]->bytes() / 1048576.0
+                          << " Mb of activations and gradients (" << plans[w]->unplanned_bytes() / 1048576.0
+                          << " Mb without reuse)\n";
+        }
+        return plans[w]->step(batch_X[w], batch_y[w], ready);
+    };
+
+    // Mixed precision: float32 working model with its own batch buffers and plan, the
+    // L2 term is added to the master gradients so the working model has none
+    if (this->mixed && (workers > 1 || ranks > 1))
+        throw std::runtime_error("Error: Mixed precision runs on one worker and one rank!\n");
+    const long GROWTH_INTERVAL = 2000;
+    Model<float> working;
+    if (this->mixed)
+        working = this->model.template cast<float>(0.0);
+    BasicMatrix<float> low_X, low_y;
+    std::unique_ptr<Plan<float>> working_plan;
+    double loss_scale = start.loss_scale > 0.0 ? start.loss_scale : 65536.0;
+    long good_steps = 0, skipped = 0;
+    double comm_seconds = this->comm ? this->comm->comm_time() : 0.0;
+    double wait_seconds = this->comm ? this->comm->wait_time() : 0.0;
 
-    // Create validation folds
-    vector<int> dataset_indices(dataset.first.size());
-    for (int i = 0; i < (int)dataset.first.size(); i++){
+    // Create validation folds, the same ones as the run being resumed
+    if (resumed)
+        this->generator.restore(start.folds);
+    rng::Philox::State folds = this->generator.state();
+    int dataset_size = std::get<0>(dataset.first.shape());
+    vector<int> dataset_indices(dataset_size);
+    for (int i = 0; i < dataset_size; i++){
         dataset_indices[i] = i;
     }
     auto val_indices = split_indices(dataset_indices, 10);
+    if (resumed)
+        this->generator.restore(start.rng);
 
     // Sort validation indices to be able to easily exclue them out of train
     for (int i = 0; i < (int)val_indices.size(); i++) {
         std::sort(val_indices[i].begin(), val_indices[i].end());
     }
 
+    // Evaluation buffers, reused by every epoch
+    Matrix eval_X, eval_y, val_X, val_y;
+
     vector<double> loss_history;
     vector<double> train_acc_history;
     vector<double> val_acc_history;
@@ -83,13 +198,13 @@ vector<vector<double>> nn::Trainer::fit () {
     // Set the timer
     auto t1 = std::chrono::high_resolution_clock::now();
     // Set the initial validation sample to be used
-    int val_sample = 0; 
+    int val_sample = start.val_sample;
 
-    for (int epoch = 0; epoch < num_epochs; epoch++){
+    for (int epoch = (int)start.epoch; epoch < num_epochs; epoch++){
         // Generate batch indices of dataset size avoiding validation indices
         vector<int> train_indices;
         int j = 0;
-        for (int i = 0; i < (int)dataset.first.size(); i++){
+        for (int i = 0; i < dataset_size; i++){
             if (i != val_indices[val_sample][j])
                 train_indices.push_back(i);
             else
@@ -104,37 +219,153 @@ vector<vector<double>> nn::Trainer::fit () {
         auto batch_indices = split_indices(train_indices, splits);
 
         // Iterate through all batches
-        vector<double> batch_losses;
-        for (auto batch : batch_indices) {
+        auto epoch_start = std::chrono::high_resolution_clock::now();
+        vector<double> batch_losses(batch_indices.size(), 0.0);
+        long processed = 0; //samples trained on by this process
+        long skipped_before = skipped;
+        if (this->hogwild && workers > 1) {
+            // Every worker takes every count-th batch and steps the shared parameters right away
+            #pragma omp parallel num_threads(workers)
+            {
+#ifdef _OPENMP
+                int w = omp_get_thread_num(), count = omp_get_num_threads();
+#else
+                int w = 0, count = 1;
+#endif
+                for (size_t b = w; b < batch_indices.size(); b += count) {
+                    batch_losses[b] = compute(w, batch_indices[b]);
+                    #pragma omp atomic
+                    processed += batch_indices[b].size();
+                    optimizers[w]->step(replicas[w].packed_params(), this->learning_rate);
+                    workspace::reset();
+                }
+            }
+        } else {
+            for (size_t b = 0; b < batch_indices.size(); b++) {
+                auto &batch = batch_indices[b];
+                bool finite = true; //gradients fit for an optimizer step
+                if (this->mixed) {
+                    DataLoader::gather(dataset.first, dataset.second, batch, low_X, low_y);
+                    if (!working_plan || (int)batch.size() > working_plan->capacity()) {
+                        working_plan.reset(new Plan<float>(working, (int)batch.size()));
+                        std::cout << "Plan for batch " << batch.size() << ": " << working_plan->bytes() / 1048576.0
+                                  << " Mb of float32 activations and gradients\n";
+                    }
+                    this->model.export_values(working);
+                    working_plan->set_loss_scale(loss_scale);
+                    batch_losses[b] = working_plan->step(low_X, low_y);
+                    finite = this->model.import_grads(working, 1.0 / loss_scale);
+                    if (finite) {
+                        batch_losses[b] += this->model.regularize();
+                        if (++good_steps == GROWTH_INTERVAL) {
+                            loss_scale *= 2.0;
+                            good_steps = 0;
+                        }
+                    } else {
+                        // Left out of the epoch's loss, it has no L2 term and may be Inf
+                        batch_losses[b] = 0.0;
+                        loss_scale = std::max(1.0, loss_scale / 2.0);
+                        good_steps = 0;
+                        skipped++;
+                    }
+                    processed += batch.size();
+                } else if (ranks > 1) {
+                    // This rank's shard of the batch, the layers' gradients weighted by the share
+                    // of the shard are summed over the ranks during the backward of the next layers
+                    auto shard = exec::chunk((long)batch.size(), this->comm->rank(), ranks);
+                    T weight = T((double)(shard.second - shard.first) / batch.size());
+                    T *grads = this->model.packed_params().grad.data();
+                    auto ready = [&](long begin, long end) { this->comm->allreduce_async(grads + begin, end - begin, weight); };
+                    double loss = 0.0;
+                    if (shard.first < shard.second) {
+                        loss = compute(0, vector<int>(batch.begin() + shard.first, batch.begin() + shard.second), ready);
+                    } else {
+                        this->model.zero_grad();
+                        ready(0, std::get<1>(this->model.packed_params().grad.shape()));
+                    }
+                    this->comm->wait();
+                    loss *= (double)weight;
+                    this->comm->allreduce(&loss, 1);
+                    batch_losses[b] = loss;
+                    processed += shard.second - shard.first;
+                } else if (workers == 1) {
+                    batch_losses[b] = compute(0, batch);
+                    processed += batch.size();
+                } else {
+                    // One shard of the batch per worker: the mean gradients of the shards weighted
+                    // by their share of the batch add up to the mean gradient of the batch
+                    vector<double> losses(workers, 0.0), weights(workers, 0.0);
+                    #pragma omp parallel num_threads(workers)
+                    {
+#ifdef _OPENMP
+                        int w = omp_get_thread_num(), count = omp_get_num_threads();
+#else
+                        int w = 0, count = 1;
+#endif
+                        auto shard = exec::chunk((long)batch.size(), w, count);
+                        if (shard.first < shard.second) {
+                            losses[w] = compute(w, vector<int>(batch.begin() + shard.first, batch.begin() + shard.second));
+                            weights[w] = (double)(shard.second - shard.first) / batch.size();
+                        }
+                        #pragma omp barrier
 
-            // compute loss and gradients
-            auto batch_values = DataLoader::load_as_matrix(dataset.first, dataset.second, batch);
-            double loss = this->model.feed_forward(batch_values.first, batch_values.second);
+                        // Chunked reduction into the model: every worker sums its own chunk of the
+                        // packed gradients over all replicas, in blocks that stay in its cache
+                        using C = typename Matrix::compute_type;
+                        const long BLOCK = 2048;
+                        T *sum = replicas[0].packed_params().grad.data();
+                        auto chunk = exec::chunk(std::get<1>(replicas[0].packed_params().grad.shape()), w, count);
+                        for (long begin = chunk.first; begin < chunk.second; begin += BLOCK) {
+                            long end = std::min(begin + BLOCK, chunk.second);
+                            C weight = C(weights[0]);
+                            #pragma omp simd
+                            for (long i = begin; i < end; i++)
+                                sum[i] = weights[0] > 0.0 ? T(weight * C(sum[i])) : T(0);
+                            for (int r = 1; r < workers; r++) {
+                                if (weights[r] == 0.0)
+                                    continue;
+                                const T *grad = replicas[r].packed_params().grad.data();
+                                weight = C(weights[r]);
+                                #pragma omp simd
+                                for (long i = begin; i < end; i++)
+                                    sum[i] = T(C(sum[i]) + weight * C(grad[i]));
+                            }
+                        }
+                        workspace::reset();
+                    }
+                    for (int w = 0; w < workers; w++)
+                        batch_losses[b] += weights[w] * losses[w];
+                    processed += batch.size();
+                }
 
-            // optimize params
-            auto params = model.get_params();
-            for (int k = 0; k < (int)params.size(); k++){
-                params[k]->value = optimizers[k]->update(params[k]->value, params[k]->grad, this->learning_rate);
-            }
+                // optimize params, one pass over the packed buffers
+                if (finite)
+                    optimizer->step(this->model.packed_params(), this->learning_rate);
 
-            batch_losses.push_back(loss);
+                // Step boundary, the next batch reuses this one's temporaries
+                workspace::reset();
+            }
         }
+        auto epoch_end = std::chrono::high_resolution_clock::now();
+        this->samples_per_second = processed / std::chrono::duration<double>(epoch_end - epoch_start).count();
 
         // Perform learning rate decay
         this->learning_rate *= learning_rate_decay;
 
-        // Compute average loss on all batches
-        double avg_loss = std::accumulate(batch_losses.begin(), batch_losses.end(), 0.0) / (double)batch_losses.size();
+        // Compute average loss on the batches that made a step
+        long kept = (long)batch_losses.size() - (skipped - skipped_before);
+        double avg_loss = kept > 0 ? std::accumulate(batch_losses.begin(), batch_losses.end(), 0.0) / (double)kept
+                                   : std::numeric_limits<double>::quiet_NaN();
 
         // predict and compute train accuracy
-        auto train_values = DataLoader::load_as_matrix(dataset.first, dataset.second, train_indices);
-        auto result = this->model.predict(train_values.first);
-        double train_acc = compute_accuracy(result, train_values.second);
+        DataLoader::gather(dataset.first, dataset.second, train_indices, eval_X, eval_y);
+        auto result = this->model.predict(eval_X);
+        double train_acc = compute_accuracy(result, eval_y);
 
         // predict and compute validation accuracy
-        auto val_values = DataLoader::load_as_matrix(dataset.first, dataset.second, val_indices[val_sample]);
-        result = this->model.predict(val_values.first);
-        double val_acc = compute_accuracy(result, val_values.second);
+        DataLoader::gather(dataset.first, dataset.second, val_indices[val_sample], val_X, val_y);
+        result = this->model.predict(val_X);
+        double val_acc = compute_accuracy(result, val_y);
 
         // Compute the runtime of the neural network
         auto t2 = std::chrono::high_resolution_clock::now();
@@ -142,7 +373,37 @@ vector<vector<double>> nn::Trainer::fit () {
 
         // Display the results of an epoch
         std::cout <<  "#" << epoch << " Train accuracy: " << train_acc \
-            << ", val accuracy: " << val_acc << ", Time left: " << dur / 1000.0 << "\n";
+            << ", val accuracy: " << val_acc << ", Time left: " << dur / 1000.0 \
+            << ", Workspace peak: " << workspace::stats().peak / 1048576.0 << " Mb" \
+            << ", Grad norm: " << this->model.grad_norm() \
+            << ", Samples/s: " << this->samples_per_second;
+        if (this->mixed)
+            std::cout << ", Loss scale: " << loss_scale << " (" << skipped - skipped_before << " skipped)";
+        // Share of non-zero inputs of every FC layer after a ReLU, the sparse path runs below
+        // the threshold, measured by the training steps (1 for the dense inputs)
+        std::cout << ", Input density:";
+        for (double density : this->mixed ? working.densities() : this->model.densities())
+            std::cout << " " << density;
+        std::cout << "\n";
+
+        // Throughput and communication time of every rank in this epoch, gathered as a sum
+        if (ranks > 1) {
+            vector<double> stats(3 * ranks, 0.0);
+            int rank = this->comm->rank();
+            stats[3 * rank] = this->samples_per_second;
+            stats[3 * rank + 1] = this->comm->comm_time() - comm_seconds;
+            stats[3 * rank + 2] = this->comm->wait_time() - wait_seconds;
+            this->comm->allreduce(stats.data(), (long)stats.size());
+            comm_seconds = this->comm->comm_time();
+            wait_seconds = this->comm->wait_time();
+            double total = 0.0;
+            for (int r = 0; r < ranks; r++) {
+                total += stats[3 * r];
+                std::cout << "    rank " << r << ": " << stats[3 * r] << " samples/s, all-reduce " << stats[3 * r + 1]
+                          << " s, waited " << stats[3 * r + 2] << " s\n";
+            }
+            std::cout << "    all ranks: " << total << " samples/s\n";
+        }
 
         // Store the epoch results
         loss_history.push_back(avg_loss);
@@ -154,7 +415,29 @@ vector<vector<double>> nn::Trainer::fit () {
             val_sample++;
         else
             val_sample = 0;
+
+        // Snapshot for the background writer, rank 0 writes the checkpoint of every rank
+        bool last = epoch + 1 == num_epochs;
+        if (this->writer && ((epoch + 1) % this->checkpoint_every == 0 || last)
+            && (!this->comm || this->comm->rank() == 0)) {
+            TrainingState progress;
+            progress.epoch = epoch + 1;
+            progress.val_sample = val_sample;
+            progress.learning_rate = this->learning_rate;
+            progress.loss_scale = this->mixed ? loss_scale : 0.0;
+            progress.folds = folds;
+            progress.rng = this->generator.state();
+            this->writer->save(this->checkpoint_path, this->model, optimizer.get(), progress);
+        }
+    }
+    if (this->writer) {
+        this->writer->wait();
+        std::cout << "Checkpoints: " << this->writer->write_time() << " s written in the background, "
+                  << this->writer->stall_time() << " s waited for\n";
     }
 
     return vector<vector<double>>{loss_history, train_acc_history, val_acc_history};
-}
\ No newline at end of file
+}
+
+template class nn::Trainer<double>;
+template class nn::Trainer<float>;
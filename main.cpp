@@ -1,12 +1,196 @@
 #include <iostream>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
 #include "MatrixLib/Matrix.hpp"
 #include "NeuralNet.hpp"
 #include "DataLoader.hpp"
+#include "Distributed.hpp"
+
+
+// Heap allocations of the whole program, counted for the test of the planned steps.
+// Not inlined, GCC would pair the free() of an inlined delete with the builtin new.
+static std::atomic<long> heap_allocations(0);
+
+void *operator new (size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete (void *ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete (void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+
+/*
+* Real NN workcycle: loads the dataset, trains the model and
+* evaluates it on the test set with matrices of element type T,
+* with the hidden ReLU fused into its FCLayer if fused is set,
+* with AdamW in place of SGD if adam is set and data-parallel
+* on workers threads (Hogwild if hogwild is set). Under launched
+* ranks, every rank trains on its shard of the batches. With
+* mixed set, T holds the master weights of mixed precision.
+* A checkpoint is written to save after every epoch if set, the
+* training continues from the checkpoint resume if set.
+*/
+template <class T>
+void train_and_evaluate (bool fused, bool adam, int workers, bool hogwild, bool mixed = false,
+                         const std::string &save = "", const std::string &resume = "") {
+    // Set fixed output precision
+    std::cout << std::fixed;
+
+    // Data loading
+    DataLoader data_loader;
+
+    Dataset<T> train_data = data_loader.load_dataset<T>("data/train_32x32.dat", std::pair<int, int>(20000, 3072));
+    Dataset<T> test_data = data_loader.load_dataset<T>("data/test_32x32.dat", std::pair<int, int>(2000, 3072));
+
+    data_loader.prepare_dataset(train_data.first, test_data.first);
+
+    // Create and train model
+    // AdamW decays the weights itself instead of the L2 term of the loss
+    nn::Model<T> model(3072, 10, 512, adam ? 0.0 : 1e-4, fused);
+    nn::Optim<T> *optim = adam ? (nn::Optim<T> *)new nn::Adam<T>(0.9, 0.999, 1e-8, 1e-2) : new nn::SGD<T>();
+    nn::Trainer<T> trainer(model, train_data, optim, adam ? 30 : 100, 400, adam ? 1e-3 : 1e-1, 1.0);
+    trainer.data_parallel(workers, hogwild);
+    trainer.mixed_precision(mixed);
+    if (!save.empty())
+        trainer.checkpoint(save);
+    if (!resume.empty())
+        trainer.resume(resume);
+    dist::Communicator comm;
+    if (comm.size() > 1)
+        trainer.distribute(comm);
+
+    // Fit model and count the execution time
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto results = trainer.fit();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    long double dur = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+
+    // Display the model runtime in a beautiful way
+    std::cout << "Computed for " << std::defaultfloat;
+    if (dur > 1000) {
+        if (dur > 60000) {
+            if (dur > 3600000) {
+                std::cout << dur / 3600000 << " hours\n";
+            } else
+                std::cout << dur / 60000 << " minuts\n";
+        } else
+            std::cout << dur / 1000 << " seconds\n";
+    } else
+        std::cout << dur << " milliseconds\n";
+
+    // Display the best results
+    std::cout << "\nBest results:\nLoss: " << *std::min_element(results[0].begin(), results[0].end()) / 2 \
+            << ", Train accuracy: " << *std::max_element(results[1].begin(), results[1].end()) \
+            << ", Valid accuracy: " << *std::max_element(results[2].begin(), results[2].end()) << "\n";
+
+    // Predict on test, the whole test set is already a contiguous matrix
+    BasicMatrix<T> test_pred;
+    test_pred = model.predict(test_data.first);
+    // Compute the final score accuracy
+    double test_accuracy = nn::Trainer<T>::compute_accuracy(test_pred, test_data.second);
+    std::cout << std::defaultfloat << "\nNeural net test accuracy: " << test_accuracy << "\n";
+
+    // Post-training int8 quantization, calibrated on a slice of the train set
+    nn::QuantizedModel<T> quantized(model, BasicMatrix<T>(train_data.first.row_range(0, 1000)));
+    t1 = std::chrono::high_resolution_clock::now();
+    test_pred = model.predict(test_data.first);
+    t2 = std::chrono::high_resolution_clock::now();
+    BasicMatrix<T> quantized_pred = quantized.predict(test_data.first);
+    auto t3 = std::chrono::high_resolution_clock::now();
+    double float_time = std::chrono::duration<double>(t2 - t1).count();
+    double int8_time = std::chrono::duration<double>(t3 - t2).count();
+    double quantized_accuracy = nn::Trainer<T>::compute_accuracy(quantized_pred, test_data.second);
+    int samples = std::get<0>(test_data.first.shape());
+    std::cout << "Int8 (" << qgemm::kernel_name() << ") test accuracy: " << quantized_accuracy \
+            << " (" << quantized_accuracy - test_accuracy << ")\n" \
+            << "Inferences per second: " << samples / float_time << " float, " \
+            << samples / int8_time << " int8\n";
+}
+
+
+/*
+* Serving workcycle: the model of a checkpoint is mapped instead
+* of trained and evaluated on the test set, any number of these
+* processes share the pages of its weights.
+*/
+template <class T>
+void evaluate (const std::string &path) {
+    DataLoader data_loader;
+    Dataset<T> train_data = data_loader.load_dataset<T>("data/train_32x32.dat", std::pair<int, int>(20000, 3072));
+    Dataset<T> test_data = data_loader.load_dataset<T>("data/test_32x32.dat", std::pair<int, int>(2000, 3072));
+    data_loader.prepare_dataset(train_data.first, test_data.first);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    nn::Model<T> model = nn::Checkpoint<T>::load_model(path);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    BasicMatrix<T> test_pred = model.predict(test_data.first);
+    auto t3 = std::chrono::high_resolution_clock::now();
+    double test_accuracy = nn::Trainer<T>::compute_accuracy(test_pred, test_data.second);
+    std::cout << "Loaded " << path << " in " << std::chrono::duration<double>(t2 - t1).count() * 1000.0 << " ms\n"
+              << "Neural net test accuracy: " << test_accuracy << " in "
+              << std::chrono::duration<double>(t3 - t2).count() * 1000.0 << " ms\n";
+}
+
+
+/*
+* Data-parallel scaling: training samples per second of an epoch
+* for 1, 2, 4... worker threads up to all of them, synchronous and
+* Hogwild, on the real dataset.
+*/
+template <class T>
+void scaling () {
+    DataLoader data_loader;
+    Dataset<T> train_data = data_loader.load_dataset<T>("data/train_32x32.dat", std::pair<int, int>(20000, 3072));
+    Dataset<T> test_data = data_loader.load_dataset<T>("data/test_32x32.dat", std::pair<int, int>(2000, 3072));
+    data_loader.prepare_dataset(train_data.first, test_data.first);
+
+    vector<int> counts;
+    for (int workers = 1; workers < exec::num_threads(); workers *= 2)
+        counts.push_back(workers);
+    counts.push_back(exec::num_threads());
+
+    std::cout << "workers  sync samples/s  speedup  hogwild samples/s  speedup\n";
+    double base[2] = { 0.0, 0.0 };
+    for (int workers : counts) {
+        std::cout << workers;
+        for (int hogwild = 0; hogwild < 2; hogwild++) {
+            nn::Model<T> model(3072, 10, 512, 1e-4);
+            nn::Trainer<T> trainer(model, train_data, new nn::SGD<T>(), 1, 400, 1e-1, 1.0);
+            trainer.data_parallel(workers, hogwild);
+            std::streambuf *log = std::cout.rdbuf(nullptr);
+            trainer.fit();
+            std::cout.rdbuf(log);
+            if (workers == 1)
+                base[hogwild] = trainer.throughput();
+            std::cout << "  " << trainer.throughput() << "  " << trainer.throughput() / base[hogwild];
+        }
+        std::cout << "\n";
+    }
+}
 
 
 int main (int argc, char * argv[]) {
+
+    // ranks=n runs n processes of this program, the spawned ones only print through rank 0
+    int ranks = 1;
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]).compare(0, 6, "ranks=") == 0)
+            ranks = std::stoi(std::string(argv[i]).substr(6));
+    int rank = dist::launch(ranks, argv);
+    if (rank != 0)
+        std::cout.rdbuf(nullptr);
     
     // Test area of the entire functional, use test as an argument to see it
 
@@ -30,7 +214,7 @@ int main (int argc, char * argv[]) {
             a = a + 2.0;
             a.print();
             std::cout << "Matrix multiplyed by scalar:\n";
-            (a * 0.03).print();
+            (a * 0.03).eval().print();
             std::cout << "Dot product:\n";
             a = Matrix(vector<vector<double>>{{1, 2, 3}, {3, 4, 5}});
             (a.dot(a.T() + 6)).print();
@@ -50,26 +234,34 @@ int main (int argc, char * argv[]) {
             b = b.reshape(1, -1);
             b.print();
             std::cout << "Broadcasted matrix [1x1]:\n";
-            a = (Matrix(1, 1) + 1).broadcast(std::make_tuple(2, 2));
+            a = (Matrix(1, 1) + 1).eval().broadcast(std::make_tuple(2, 2));
             a.print();
             std::cout << "Elementwise addiction with broadcasting:\n";
-            (a.reshape(-1, 1) + b).print();
+            (a.reshape(-1, 1) + b).eval().print();
             std::cout << "Elementwise multiplication with broadcasting:\n";
             a = Matrix(vector<vector<double>>{{0, 1, 2}});
             b = Matrix(vector<vector<double>>{{0, 1, 2}, {3, 4, 5}, {6, 7, 8}});
-            (a * b).print();
+            (a * b).eval().print();
+            std::cout << "Update with a row of itself:\n";
+            Matrix c(vector<vector<double>>{{1, 2, 3}, {4, 5, 6}, {7, 8, 9}, {10, 11, 12}});
+            c -= c.row_range(0, 1);
+            c.print();
+            std::cout << "Assignment with a broadcast of itself:\n";
+            c = Matrix(vector<vector<double>>{{1, 2, 3}, {4, 5, 6}, {7, 8, 9}, {10, 11, 12}});
+            c = c - c.row_range(0, 1);
+            c.print();
             
             std::cout << "Operator greater:\n";
             (b > 4.0).print();
             
             std::cout << "ReLU function:\n";
             a = Matrix(vector<vector<double>>{{4, -1, -2}, {-3, 4, 5}, {6, -7, 8}});
-            nn::ReLULayer layer;
+            nn::ReLULayer<double> layer;
             layer.forward(a).print();
 
             std::cout << "FCLayer:\n";
             Matrix x( vector<vector<double>>{ { 1, -2, 3 }, { -1, 2, 0.1 } } );
-            nn::FCLayer fc_layer(3, 4);
+            nn::FCLayer<double> fc_layer(3, 4);
             Matrix res = fc_layer.forward(x);
             res.print();
             x = Matrix(vector<vector<double>>{ { 1, -2, 3, 4 }, { -1, 2, 0.1, 1 } });
@@ -84,77 +276,112 @@ int main (int argc, char * argv[]) {
             Matrix preds(vector<vector<double>>{ { 0.1, 0.2, 0.3, 0.4 }, { 0.4, 0.3, 0.2, 0.1 }});
             Matrix gt_ind(1, 1);
             gt_ind = Matrix(vector<vector<double>>{ { 3 }, { 1 }});
-            std::cout << "ce_loss: " << nn::SoftmaxLayer::ce_loss(preds, gt_ind) << "\nsoftmax:\n";
-            nn::SoftmaxLayer::softmax(preds).print();
+            std::cout << "ce_loss: " << nn::SoftmaxLayer<double>::ce_loss(preds, gt_ind) << "\nsoftmax:\n";
+            nn::SoftmaxLayer<double>::softmax(preds).print();
             std::cout << "softmax_with_ce_loss loss: " << \
-                nn::SoftmaxLayer::softmax_with_ce_loss(preds, gt_ind).first << "\nsoftmax_with_ce_loss grad:\n";
-            nn::SoftmaxLayer::softmax_with_ce_loss(preds, gt_ind).second.print();
-            std::cout << "l2_reg loss: \n" << nn::SoftmaxLayer::l2_reg(preds, 0.9).first << "\nl2_reg grad:\n";
+                nn::SoftmaxLayer<double>::softmax_with_ce_loss(preds, gt_ind).first << "\nsoftmax_with_ce_loss grad:\n";
+            nn::SoftmaxLayer<double>::softmax_with_ce_loss(preds, gt_ind).second.print();
+            std::cout << "l2_reg loss: \n" << nn::SoftmaxLayer<double>::l2_reg(preds, 0.9).first << "\nl2_reg grad:\n";
             
-            nn::SoftmaxLayer::l2_reg(preds, 0.9).second.print();
+            nn::SoftmaxLayer<double>::l2_reg(preds, 0.9).second.print();
 
             std::cout << "Actual nn practice:\n";
-            nn::Model model(8, 2, 4, 1e-2);
+            nn::Model<double> model(8, 2, 4, 1e-2);
             x = Matrix(vector<vector<double>>{ { 0.1, 0.2, 0.3, 0.4, 0.4, 0.3, 0.2, 0.1 }});
             Matrix y(1, 1);
             y = 1;
             for (int i = 0; i < 3; i++)
                 std::cout << "Loss: " << model.feed_forward(x, y) << "\n";
+
+            // Every kernel parallel on 4 threads, so that the reductions combine partials
+            std::cout << "Planned step allocations:\n";
+            int threads = exec::num_threads();
+            vector<long> grains;
+            for (int kind = 0; kind < exec::KIND_COUNT; kind++) {
+                grains.push_back(exec::grain((exec::Kind)kind));
+                exec::set_grain((exec::Kind)kind, 0);
+            }
+            exec::set_num_threads(4);
+            double threshold = nn::FCLayer<double>::sparse_threshold;
+            nn::Model<double> planned(64, 10, 32, 1e-2, true);
+            Matrix batch_x(50, 64), batch_y(50, 1);
+            batch_x.fill_rand(7);
+            for (int i = 0; i < 50; i++)
+                batch_y.data()[i] = i % 10;
+            nn::Plan<double> plan(planned, 50);
+            for (double sparse_threshold : { 0.0, 1.0 }) {
+                // The first step fills the caches, the next ones shouldn't allocate
+                nn::FCLayer<double>::sparse_threshold = sparse_threshold;
+                long heap = 0;
+                size_t system = 0;
+                for (int step = 0; step < 3; step++) {
+                    workspace::reset();
+                    long heap_before = heap_allocations.load();
+                    size_t system_before = workspace::stats().system_allocs;
+                    planned.zero_grad();
+                    plan.step(batch_x, batch_y);
+                    planned.grad_norm();
+                    heap = heap_allocations.load() - heap_before;
+                    system = workspace::stats().system_allocs - system_before;
+                }
+                std::cout << (sparse_threshold > 0.0 ? "Sparse" : "Dense") << " path: " << heap
+                          << " heap, " << system << " workspace system allocations\n";
+            }
+            nn::FCLayer<double>::sparse_threshold = threshold;
+            exec::set_num_threads(threads);
+            for (int kind = 0; kind < exec::KIND_COUNT; kind++)
+                exec::set_grain((exec::Kind)kind, grains[kind]);
+        } else {
+            // Real NN workcycle, float trains in float32, fused fuses the hidden ReLU,
+            // adam trains with AdamW, workers=n trains on n model replicas, hogwild
+            // lets them update the parameters asynchronously, scaling only measures
+            // the samples per second against the number of workers, ranks=n (above) trains
+            // on n processes, mixed computes in float32 on double master weights, save=file
+            // writes a checkpoint after every epoch, resume=file continues from one and
+            // load=file only evaluates the model of one
+            bool use_float = false, fused = false, adam = false, hogwild = false, scale = false, mixed = false;
+            std::string save, resume, load;
+            int workers = 1;
+            for (int i = 1; i < argc; i++) {
+                std::string arg(argv[i]);
+                use_float |= arg == "float";
+                fused |= arg == "fused";
+                adam |= arg == "adam";
+                hogwild |= arg == "hogwild";
+                scale |= arg == "scaling";
+                mixed |= arg == "mixed";
+                if (arg.compare(0, 8, "workers=") == 0)
+                    workers = std::stoi(arg.substr(8));
+                if (arg.compare(0, 5, "save=") == 0)
+                    save = arg.substr(5);
+                if (arg.compare(0, 7, "resume=") == 0)
+                    resume = arg.substr(7);
+                if (arg.compare(0, 5, "load=") == 0)
+                    load = arg.substr(5);
+            }
+            if (!load.empty()) {
+                if (use_float)
+                    evaluate<float>(load);
+                else
+                    evaluate<double>(load);
+            } else if (scale) {
+                if (use_float)
+                    scaling<float>();
+                else
+                    scaling<double>();
+            } else if (use_float)
+                train_and_evaluate<float>(fused, adam, workers, hogwild, mixed, save, resume);
+            else
+                train_and_evaluate<double>(fused, adam, workers, hogwild, mixed, save, resume);
         }
     } else {
-        
-        // Real NN workcycle comes down here
-        
-        // Set fixed output precision
-        std::cout << std::fixed;
-
-        // Data loading
-        DataLoader data_loader;
-
-        DATASET_TYPE train_data = data_loader.load_dataset("data/train_32x32.dat", std::pair<int, int>(20000, 3072));
-        DATASET_TYPE test_data = data_loader.load_dataset("data/test_32x32.dat", std::pair<int, int>(2000, 3072));
-
-        data_loader.prepare_dataset(train_data.first, test_data.first);
-
-        // Create and train model
-        nn::Model model(3072, 10, 512, 1e-4);
-        nn::Trainer trainer(model, train_data, new nn::SGD<double>(), 100, 400, 1e-1, 1.0);
-
-        // Fit model and count the execution time
-        auto t1 = std::chrono::high_resolution_clock::now();
-        auto results = trainer.fit();
-        auto t2 = std::chrono::high_resolution_clock::now();
-        long double dur = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
-
-        // Display the model runtime in a beautiful way
-        std::cout << "Computed for " << std::defaultfloat;
-        if (dur > 1000) {
-            if (dur > 60000) {
-                if (dur > 3600000) {
-                    std::cout << dur / 3600000 << " hours\n";
-                } else
-                    std::cout << dur / 60000 << " minuts\n";
-            } else
-                std::cout << dur / 1000 << " seconds\n";
-        } else
-            std::cout << dur << " milliseconds\n";
-
-        // Display the best results
-        std::cout << "\nBest results:\nLoss: " << *std::min_element(results[0].begin(), results[0].end()) / 2 \
-                << ", Train accuracy: " << *std::max_element(results[1].begin(), results[1].end()) \
-                << ", Valid accuracy: " << *std::max_element(results[2].begin(), results[2].end()) << "\n";
-
-        // Predict on test
-        Matrix test_pred;
-        vector<int> idx;
-        for (int i = 0; i < (int)test_data.second.size(); i++)
-            idx.push_back(i);
-        auto test = data_loader.load_as_matrix(test_data.first, test_data.second, idx);
-        test_pred = model.predict(test.first);
-        // Compute the final score accuracy
-        double test_accuracy = nn::Trainer::compute_accuracy(test_pred, test.second);
-        std::cout << std::defaultfloat << "\nNeural net test accuracy: " << test_accuracy << "\n";
+        // Real NN workcycle in float64
+        train_and_evaluate<double>(false, false, 1, false);
     }
 
+    if (rank == 0 && !dist::finish()) {
+        std::cout << "Some of the ranks failed!\n";
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file